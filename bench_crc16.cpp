@@ -0,0 +1,66 @@
+// throughput of the crc16 kernels, in bytes per cycle (per ns where there is
+// no cycle counter), for a short frame, the largest rtu frame and a stream
+
+#include "crc16.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "bytes/cycle"
+static uint64_t ticks() { return __rdtsc(); }
+#else
+#define BENCH_UNIT "bytes/ns"
+static uint64_t ticks() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+#endif
+
+int main() {
+    using kernel = rx::crc16::kernel;
+    const struct {
+        kernel with;
+        const char *name;
+    } kernels[] = {{kernel::bitwise, "bitwise"}, {kernel::table, "table"}, {kernel::slice8, "slice8"},
+                   {kernel::best, "best"}};
+    const size_t sizes[] = {8, 256, 64 * 1024};
+    const size_t total = 64 * 1024 * 1024; // bytes hashed per measurement
+
+    std::vector<uint8_t> data(sizes[2]);
+    srand(1);
+    for (auto &byte : data) {
+        byte = static_cast<uint8_t>(rand());
+    }
+
+    printf("%-8s", "size");
+    for (const auto &k : kernels) {
+        printf("%12s", k.name);
+    }
+    printf("   (%s)\n", BENCH_UNIT);
+    for (size_t size : sizes) {
+        printf("%-8zu", size);
+        uint16_t expected = rx::crc16::compute(data.data(), size, kernel::bitwise);
+        for (const auto &k : kernels) {
+            // one warm-up pass, then the timed ones, chained so none is skipped
+            uint16_t crc = rx::crc16::compute(data.data(), size, k.with);
+            if (crc != expected) {
+                printf("\n%s disagrees: %04x != %04x\n", k.name, crc, expected);
+                return 1;
+            }
+            size_t rounds = total / size / (k.with == kernel::bitwise ? 8 : 1);
+            uint64_t start = ticks();
+            for (size_t i = 0; i < rounds; i++) {
+                crc = rx::crc16::update(crc, data.data(), size, k.with);
+            }
+            uint64_t elapsed = ticks() - start;
+            volatile uint16_t sink = crc;
+            (void)sink;
+            printf("%12.3f", static_cast<double>(rounds * size) / static_cast<double>(elapsed));
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,611 @@
+// what the library costs: for every source and operator in rx.hpp, the
+// subjects in subject.h and refc_ptr copies, the time and heap allocations
+// per element and the cost of building the chain. printed as json, so runs
+// can be kept and compared:
+//
+//     ./bench_rx > before.json
+//     ./bench_rx map > map.json      (only benchmarks with "map" in the name)
+//
+// each entry is
+//
+//     {"name": "map", "elements": 262144, "runs": 12, "ns_per_element": 3.1,
+//      "allocs_per_element": 0, "setup_ns": 95, "setup_allocs": 3}
+//
+// where setup is building the chain and dropping it again, unsubscribed,
+// and the rest is subscribing it and running it to the end. allocations
+// are counted on every thread, the timer and pool threads included.
+
+#include "fused.hpp"
+#include "refc_ptr.hpp"
+#include "rx.hpp"
+#include "subject.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+static std::atomic<uint64_t> allocations{0};
+
+// every replacement below goes through this pair. out of line, so the
+// compiler doesn't see a `free` paired with an `operator new` and warn.
+[[gnu::noinline]] static void *counted_alloc(size_t size, size_t alignment = 0) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size = size != 0 ? size : 1;
+    void *p = alignment == 0 ? std::malloc(size)
+                             : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+[[gnu::noinline]] static void counted_free(void *p) noexcept { std::free(p); }
+
+void *operator new(size_t size) { return counted_alloc(size); }
+void *operator new[](size_t size) { return counted_alloc(size); }
+void *operator new(size_t size, std::align_val_t align) { return counted_alloc(size, static_cast<size_t>(align)); }
+void *operator new[](size_t size, std::align_val_t align) { return counted_alloc(size, static_cast<size_t>(align)); }
+
+void operator delete(void *p) noexcept { counted_free(p); }
+void operator delete[](void *p) noexcept { counted_free(p); }
+void operator delete(void *p, size_t) noexcept { counted_free(p); }
+void operator delete[](void *p, size_t) noexcept { counted_free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { counted_free(p); }
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// where elements end up, so nothing is optimized away
+uint64_t sink = 0;
+
+template <typename T>
+void consume(const T &value) {
+    if constexpr (std::is_arithmetic_v<T>) {
+        sink += static_cast<uint64_t>(value);
+    } else {
+        sink += sizeof(value);
+    }
+}
+
+auto sink_int = [](int value) {
+    consume(value);
+};
+
+struct result {
+    std::string name;
+    size_t elements;
+    size_t runs;
+    double ns_per_element;
+    double allocs_per_element;
+    double setup_ns;
+    double setup_allocs;
+};
+
+std::vector<result> results;
+const char *filter = nullptr;
+
+// runs are repeated until they took this long together
+constexpr auto min_time = 100ms;
+constexpr int setup_rounds = 64;
+
+uint64_t elapsed_ns(clock_type::time_point since) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - since).count());
+}
+
+// `build()` makes whatever is measured, `run(built)` pushes `elements`
+// elements through it
+template <typename Build, typename Run>
+void bench(const char *name, size_t elements, Build &&build, Run &&run) {
+    if (filter != nullptr && std::strstr(name, filter) == nullptr) {
+        return;
+    }
+    std::fprintf(stderr, "%s\n", name);
+
+    uint64_t allocs = allocations.load();
+    auto start = clock_type::now();
+    for (int i = 0; i < setup_rounds; i++) {
+        auto built = build();
+        (void)built;
+    }
+    double setup_ns = static_cast<double>(elapsed_ns(start)) / setup_rounds;
+    double setup_allocs = static_cast<double>(allocations.load() - allocs) / setup_rounds;
+
+    // one to warm up
+    {
+        auto built = build();
+        run(built);
+    }
+    size_t runs = 0;
+    uint64_t ns = 0;
+    uint64_t run_allocs = 0;
+    while (runs == 0 || ns < static_cast<uint64_t>(std::chrono::nanoseconds(min_time).count())) {
+        auto built = build();
+        allocs = allocations.load();
+        start = clock_type::now();
+        run(built);
+        ns += elapsed_ns(start);
+        run_allocs += allocations.load() - allocs;
+        runs++;
+    }
+    double total = static_cast<double>(runs * std::max<size_t>(elements, 1));
+    results.push_back({name, elements, runs, static_cast<double>(ns) / total, static_cast<double>(run_allocs) / total,
+                       setup_ns, setup_allocs});
+}
+
+// an operator applied to `range(0, n)`, subscribed with `consume`
+template <typename Apply>
+void bench_operator(const char *name, size_t n, Apply &&apply) {
+    bench(
+        name, n,
+        [n, &apply] {
+            return apply(rx::range(0, static_cast<int>(n)));
+        },
+        [](auto &chain) {
+            chain->subscribe([](const auto &value) {
+                consume(value);
+            });
+        });
+}
+
+// a subject with one subscriber, fed `n` elements
+template <typename Make>
+void bench_subject(const char *name, size_t n, Make &&make) {
+    bench(
+        name, n,
+        [&make] {
+            auto subject = make();
+            subject->subscribe(sink_int);
+            return subject;
+        },
+        [n](auto &subject) {
+            for (size_t i = 0; i < n; i++) {
+                subject->on_next(static_cast<int>(i));
+            }
+        });
+}
+
+void print_json(FILE *out) {
+    std::fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto &r = results[i];
+        std::fprintf(out,
+                     "    {\"name\": \"%s\", \"elements\": %zu, \"runs\": %zu, \"ns_per_element\": %.3f, "
+                     "\"allocs_per_element\": %.4f, \"setup_ns\": %.1f, \"setup_allocs\": %.2f}%s\n",
+                     r.name.c_str(), r.elements, r.runs, r.ns_per_element, r.allocs_per_element, r.setup_ns,
+                     r.setup_allocs, i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+}
+
+void sources() {
+    const size_t n = 1 << 18;
+    bench_operator("range", n, [](auto source) {
+        return source;
+    });
+    bench(
+        "range.batched", n,
+        [n] {
+            return rx::range(0, static_cast<int>(n));
+        },
+        [](auto &chain) {
+            chain->subscribe(rx::observer<int>(sink_int, [](rx::span<const int> values) {
+                for (int value : values) {
+                    consume(value);
+                }
+            }));
+        });
+    std::vector<int> values(n, 1);
+    bench(
+        "from.vector", n,
+        [&values] {
+            return rx::from(values);
+        },
+        [](auto &chain) {
+            chain->subscribe(sink_int);
+        });
+    bench(
+        "of", 8,
+        [] {
+            return rx::of(1, 2, 3, 4, 5, 6, 7, 8);
+        },
+        [](auto &chain) {
+            chain->subscribe(sink_int);
+        });
+    bench(
+        "repeat", n,
+        [n] {
+            return rx::repeat(1, n);
+        },
+        [](auto &chain) {
+            chain->subscribe(sink_int);
+        });
+    bench(
+        "start", 1,
+        [] {
+            return rx::start([] {
+                return 1;
+            });
+        },
+        [](auto &chain) {
+            chain->subscribe(sink_int);
+        });
+    bench(
+        "defer", 1,
+        [] {
+            return rx::defer<int>([] {
+                return rx::observable<int>([](const rx::observer<int> &next) {
+                    next(1);
+                });
+            });
+        },
+        [](auto &chain) {
+            chain->subscribe(sink_int);
+        });
+    // ticks back to back on the run loop
+    bench(
+        "interval", 10000,
+        [] {
+            return rx::interval<int>(0ms)->take(10000);
+        },
+        [](auto &chain) {
+            chain->subscribe(sink_int);
+        });
+
+    std::string text;
+    for (size_t i = 0; i < n; i++) {
+        text += std::to_string(i);
+        text += ' ';
+    }
+    // the stream is made with the chain, a parsed one can't be run again
+    bench(
+        "from_istream.int", n,
+        [&text] {
+            auto iss = std::make_shared<std::istringstream>(text);
+            return std::make_pair(iss, rx::from_istream<int>(*iss));
+        },
+        [](auto &built) {
+            built.second->subscribe(sink_int);
+        });
+    bench(
+        "from_istream.char", text.size(),
+        [&text] {
+            auto iss = std::make_shared<std::istringstream>(text);
+            return std::make_pair(iss, rx::from_istream<char>(*iss));
+        },
+        [](auto &built) {
+            built.second->subscribe([](char c) {
+                consume(c);
+            });
+        });
+    const char *path = "bench_rx.tmp";
+    if (FILE *file = std::fopen(path, "w")) {
+        std::fwrite(text.data(), 1, text.size(), file);
+        std::fclose(file);
+        bench(
+            "from_file.int", n,
+            [path] {
+                return rx::from_file<int>(path);
+            },
+            [](auto &chain) {
+                chain->subscribe(sink_int);
+            });
+        std::remove(path);
+    }
+
+    bench(
+        "merge", 2 * n,
+        [n] {
+            return rx::merge(rx::range(0, static_cast<int>(n)), rx::range(0, static_cast<int>(n)));
+        },
+        [](auto &chain) {
+            chain->subscribe(sink_int);
+        });
+    bench(
+        "concat", 2 * n,
+        [n] {
+            return rx::concat(rx::range(0, static_cast<int>(n)), rx::range(0, static_cast<int>(n)));
+        },
+        [](auto &chain) {
+            chain->subscribe(sink_int);
+        });
+    bench(
+        "zip", n,
+        [n] {
+            return rx::zip(rx::range(0, static_cast<int>(n)), rx::range(0, static_cast<int>(n)));
+        },
+        [](auto &chain) {
+            chain->subscribe([](const auto &row) {
+                consume(std::get<0>(row) + std::get<1>(row));
+            });
+        });
+    bench(
+        "combine_latest", 2 * n,
+        [n] {
+            return rx::combine_latest(rx::range(0, static_cast<int>(n)), rx::range(0, static_cast<int>(n)));
+        },
+        [](auto &chain) {
+            chain->subscribe([](const auto &row) {
+                consume(std::get<0>(row) + std::get<1>(row));
+            });
+        });
+}
+
+void operators() {
+    const size_t n = 1 << 18;
+    bench_operator("map", n, [](auto source) {
+        return source->map([](int value) {
+            return value * 2;
+        });
+    });
+    bench_operator("filter", n, [](auto source) {
+        return source->filter([](int value) {
+            return (value & 1) == 0;
+        });
+    });
+    bench_operator("scan", n, [](auto source) {
+        return source->template scan<long>(0, [](long acc, const int &value) {
+            return acc + value;
+        });
+    });
+    bench_operator("reduce", n, [](auto source) {
+        return source->reduce([](int acc, int value) {
+            return acc ^ value;
+        });
+    });
+    bench_operator("sum", n, [](auto source) {
+        return source->sum();
+    });
+    bench_operator("min", n, [](auto source) {
+        return source->min();
+    });
+    bench_operator("max", n, [](auto source) {
+        return source->max();
+    });
+    bench_operator("average", n, [](auto source) {
+        return source->average();
+    });
+    bench_operator("count", n, [](auto source) {
+        return source->count();
+    });
+    bench_operator("count_if", n, [](auto source) {
+        return source->count_if([](int value) {
+            return value & 1;
+        });
+    });
+    bench_operator("all", n, [](auto source) {
+        return source->all([](int value) {
+            return value >= 0;
+        });
+    });
+    bench_operator("skip", n, [n](auto source) {
+        return source->skip(n / 2);
+    });
+    bench_operator("skip_while", n, [n](auto source) {
+        return source->skip_while([n](int value) {
+            return static_cast<size_t>(value) < n / 2;
+        });
+    });
+    bench_operator("take", n, [n](auto source) {
+        return source->take(n / 2);
+    });
+    bench_operator("first", 1, [](auto source) {
+        return source->first();
+    });
+    bench_operator("last", n, [](auto source) {
+        return source->last();
+    });
+    bench_operator("distinct", n, [](auto source) {
+        return source
+            ->map([](int value) {
+                return value & 1023;
+            })
+            ->distinct();
+    });
+    bench_operator("distinct.window", n, [](auto source) {
+        return source
+            ->map([](int value) {
+                return value & 4095;
+            })
+            ->distinct(1024);
+    });
+    bench_operator("distinct_approx", n, [](auto source) {
+        return source
+            ->map([](int value) {
+                return value & 4095;
+            })
+            ->distinct_approx(1024);
+    });
+    bench_operator("distinct_until_changed", n, [](auto source) {
+        return source
+            ->map([](int value) {
+                return value / 4;
+            })
+            ->distinct_until_changed();
+    });
+    bench_operator("time_interval", n, [](auto source) {
+        return source->template time_interval<std::chrono::nanoseconds>();
+    });
+    bench_operator("to", n, [](auto source) {
+        return source->template to<long>([](const int &value) {
+            return static_cast<long>(value);
+        });
+    });
+    bench_operator("to_iterable", n, [](auto source) {
+        return source->template to_iterable<std::vector<int>>();
+    });
+    bench_operator("if_then_else", n / 16, [](auto source) {
+        return source->template if_then_else<int>(
+            [](const int &value) {
+                return value & 1;
+            },
+            rx::of(1), rx::of(2));
+    });
+
+    bench_operator("buffer_with_count", n, [](auto source) {
+        return source->buffer_with_count(64);
+    });
+    bench_operator("buffer_with_time", n, [](auto source) {
+        return source->buffer_with_time(1ms);
+    });
+    bench_operator("window_with_count", n, [](auto source) {
+        return source->window_with_count(64);
+    });
+    bench_operator("window_with_count.sliding", n, [](auto source) {
+        return source->window_with_count(64, 16);
+    });
+    bench_operator("window_with_time", n, [](auto source) {
+        return source->window_with_time(1ms);
+    });
+    bench_operator("window", n, [](auto source) {
+        return source->window(1ms);
+    });
+    bench(
+        "group_by", n,
+        [n] {
+            return rx::range(0, static_cast<int>(n))->group_by([](int value) {
+                return value & 15;
+            });
+        },
+        [](auto &chain) {
+            chain->subscribe([](const auto &group) {
+                group->subscribe(sink_int);
+            });
+        });
+
+    bench_operator("flat_map", n / 16, [](auto source) {
+        return source->template flat_map<int>([](int value) {
+            return rx::of(value);
+        });
+    });
+    bench_operator("flat_map.serial", n / 16, [](auto source) {
+        return source->template flat_map<int>(
+            [](int value) {
+                return rx::of(value);
+            },
+            1);
+    });
+    bench_operator("parallel_map", n, [](auto source) {
+        return source->parallel_map([](int value) {
+            return value * 2;
+        });
+    });
+    bench_operator("subscribe_on", n, [](auto source) {
+        return source->subscribe_on(rx::schedulers::current_thread());
+    });
+    bench_operator("observe_on", n, [](auto source) {
+        return source->observe_on(rx::schedulers::thread_pool());
+    });
+    bench_operator("on_backpressure_drop", n, [](auto source) {
+        return source->on_backpressure_drop();
+    });
+    bench_operator("on_backpressure_latest", n, [](auto source) {
+        return source->on_backpressure_latest();
+    });
+    bench_operator("on_backpressure_buffer", n, [](auto source) {
+        return source->on_backpressure_buffer(1024);
+    });
+    bench_operator("delay", n / 64, [](auto source) {
+        return source->delay(0ms);
+    });
+    bench_operator("debounce", n, [](auto source) {
+        return source->debounce(1ms);
+    });
+    bench_operator("sample", n, [](auto source) {
+        return source->sample(1ms);
+    });
+
+    // the same pipeline both ways
+    bench_operator("filter.map.reduce", n, [](auto source) {
+        return source
+            ->filter([](int value) {
+                return value & 1;
+            })
+            ->map([](int value) {
+                return value * 3;
+            })
+            ->reduce([](int acc, int value) {
+                return acc ^ value;
+            });
+    });
+    bench(
+        "fused.filter.map.reduce", n,
+        [n] {
+            return rx::fused::range(0, static_cast<int>(n)) | rx::fused::filter([](int value) {
+                       return value & 1;
+                   }) |
+                   rx::fused::map([](int value) {
+                       return value * 3;
+                   }) |
+                   rx::fused::reduce([](int acc, int value) {
+                       return acc ^ value;
+                   });
+        },
+        [](auto &chain) {
+            chain.subscribe(sink_int);
+        });
+}
+
+void subjects() {
+    const size_t n = 1 << 18;
+    bench_subject("subject", n, [] {
+        return std::make_unique<subject<int>>();
+    });
+    bench_subject("behavior_subject", n, [] {
+        return std::make_unique<behavior_subject<int>>(0);
+    });
+    bench_subject("replay_subject", n, [] {
+        return std::make_unique<replay_subject<int>>(64);
+    });
+    bench_subject("timed_replay_subject", n, [] {
+        return std::make_unique<timed_replay_subject<int>>(1ms);
+    });
+    bench_subject("concurrent_subject", n, [] {
+        return std::make_unique<concurrent_subject<int>>();
+    });
+}
+
+// a copy and a release per element
+template <typename Policy>
+void bench_refc(const char *name) {
+    const size_t n = 1 << 20;
+    bench(
+        name, n,
+        [] {
+            return make_refc_ptr<int, Policy>(1);
+        },
+        [n](const refc_ptr<int, Policy> &ptr) {
+            for (size_t i = 0; i < n; i++) {
+                refc_ptr<int, Policy> copy = ptr;
+                consume(*copy);
+            }
+        });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        filter = argv[1];
+    }
+    sources();
+    operators();
+    subjects();
+    bench_refc<refc_atomic>("refc_ptr.copy");
+    bench_refc<refc_local>("refc_ptr.copy.local");
+    print_json(stdout);
+    return sink == 42 ? 1 : 0;
+}
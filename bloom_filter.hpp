@@ -0,0 +1,70 @@
+#pragma once
+
+#include "flat_hash.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace rx {
+
+// a fixed-size set that may say it has seen a value it hasn't (with about
+// the probability it was sized for), but never the other way round. sized
+// for `capacity` values, past that the false positives climb.
+template <typename T, typename Hash = std::hash<T>>
+class bloom_filter {
+    std::vector<uint64_t> _bits;
+    size_t _mask;
+    unsigned _hashes;
+    Hash _hash;
+
+    // k probes from two halves of one hash (Kirsch-Mitzenmacher)
+    template <typename F>
+    bool probe(const T &value, F &&at) const {
+        uint64_t h = detail::mix_hash(static_cast<uint64_t>(_hash(value)));
+        uint64_t h1 = h & 0xffffffff;
+        uint64_t h2 = (h >> 32) | 1;
+        for (unsigned i = 0; i < _hashes; i++) {
+            if (!at(static_cast<size_t>(h1 + i * h2) & _mask)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+  public:
+    bloom_filter(size_t capacity, double fp_rate) {
+        const double ln2 = std::log(2.0);
+        double wanted = -static_cast<double>(std::max<size_t>(capacity, 1)) * std::log(fp_rate) / (ln2 * ln2);
+        size_t bits = 64;
+        while (static_cast<double>(bits) < wanted) {
+            bits *= 2;
+        }
+        _bits.assign(bits / 64, 0);
+        _mask = bits - 1;
+        double per_value = static_cast<double>(bits) / static_cast<double>(std::max<size_t>(capacity, 1));
+        _hashes = std::max(1u, static_cast<unsigned>(std::lround(per_value * ln2)));
+    }
+
+    void insert(const T &value) {
+        probe(value, [this](size_t bit) {
+            _bits[bit / 64] |= uint64_t(1) << (bit % 64);
+            return true;
+        });
+    }
+
+    bool contains(const T &value) const {
+        return probe(value, [this](size_t bit) {
+            return (_bits[bit / 64] >> (bit % 64)) & 1;
+        });
+    }
+
+    void clear() { std::fill(_bits.begin(), _bits.end(), 0); }
+
+    size_t bits() const { return _bits.size() * 64; }
+    unsigned hashes() const { return _hashes; }
+};
+
+} // namespace rx
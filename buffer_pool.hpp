@@ -0,0 +1,106 @@
+#pragma once
+
+#include "refc_ptr.hpp"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace rx {
+
+// fixed-size byte blocks that go back to the pool when the last reference
+// is dropped, so a source can hand out slices of what it read without
+// copying and still stop allocating once it is warmed up. blocks that are
+// handed out keep the pool alive, free ones are owned by it.
+class buffer_pool : public enable_refc_from_this<buffer_pool> {
+  public:
+    class block : public refc_block<refc_atomic> {
+        friend class buffer_pool;
+
+        std::unique_ptr<char[]> _data;
+        size_t _capacity;
+        refc_ptr<buffer_pool> _owner; // set while handed out
+
+        explicit block(size_t capacity)
+            : _data(new char[capacity])
+            , _capacity(capacity) {
+            this->dispose = [](refc_block<refc_atomic> *self) {
+                auto *released = static_cast<block *>(self);
+                auto owner = std::move(released->_owner);
+                owner->give_back(released);
+            };
+        }
+
+      public:
+        char *data() { return _data.get(); }
+        const char *data() const { return _data.get(); }
+        size_t capacity() const { return _capacity; }
+    };
+
+    using buffer = refc_ptr<block>;
+
+  private:
+    size_t _block_size;
+    size_t _max_free;
+    std::mutex _mtx;
+    std::vector<block *> _free;
+
+    void give_back(block *released) {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_free.size() < _max_free) {
+                _free.push_back(released);
+                return;
+            }
+        }
+        delete released;
+    }
+
+  public:
+    // keeps up to `max_free` idle blocks around for reuse
+    explicit buffer_pool(size_t block_size = 64 * 1024, size_t max_free = 1024)
+        : _block_size(block_size)
+        , _max_free(max_free) {}
+
+    buffer_pool(const buffer_pool &) = delete;
+    buffer_pool &operator=(const buffer_pool &) = delete;
+
+    ~buffer_pool() {
+        for (auto *idle : _free) {
+            delete idle;
+        }
+    }
+
+    size_t block_size() const { return _block_size; }
+
+    // a free block, or a new one if there is none. the pool must be owned
+    // by a refc_ptr.
+    buffer acquire() {
+        block *found = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (!_free.empty()) {
+                found = _free.back();
+                _free.pop_back();
+            }
+        }
+        if (found == nullptr) {
+            found = new block(_block_size);
+        }
+        found->_owner = refc_from_this();
+        return buffer(found);
+    }
+};
+
+// a view into a pooled block, which it keeps alive
+struct buffer_slice {
+    buffer_pool::buffer buffer;
+    std::string_view bytes;
+
+    const char *data() const { return bytes.data(); }
+    size_t size() const { return bytes.size(); }
+    bool empty() const { return bytes.empty(); }
+};
+
+} // namespace rx
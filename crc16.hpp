@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace rx {
+
+namespace detail {
+
+using crc16_tables_t = std::array<std::array<uint16_t, 256>, 8>;
+
+// [0] is the usual byte at a time table, [k] advances a byte's contribution
+// past k more bytes, for slice-by-8
+constexpr crc16_tables_t make_crc16_tables() {
+    crc16_tables_t tables = {};
+    for (unsigned i = 0; i < 256; i++) {
+        uint16_t crc = static_cast<uint16_t>(i);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : (crc >> 1);
+        }
+        tables[0][i] = crc;
+    }
+    for (size_t k = 1; k < 8; k++) {
+        for (unsigned i = 0; i < 256; i++) {
+            uint16_t prev = tables[k - 1][i];
+            tables[k][i] = static_cast<uint16_t>((prev >> 8) ^ tables[0][prev & 0xff]);
+        }
+    }
+    return tables;
+}
+
+inline constexpr crc16_tables_t crc16_tables = make_crc16_tables();
+
+} // namespace detail
+
+// crc-16/modbus (reflected 0x8005, starting at 0xffff, sent low byte first).
+// running it over a whole frame, crc included, gives 0. keeps the running
+// value, so a frame can be checked as its bytes come in:
+//
+//     rx::crc16 crc;
+//     crc.update(head, 3).update(rest, n);
+//     bool ok = crc.value() == 0;
+class crc16 {
+  public:
+    enum class kernel {
+        bitwise, // eight conditional shifts per byte
+        table,   // one lookup per byte
+        slice8,  // eight lookups per eight bytes, independent of each other
+        best,    // slice8, which does the tail under 8 bytes with the table
+    };
+
+    static constexpr uint16_t initial = 0xffff;
+
+  private:
+    uint16_t _crc = initial;
+
+    static uint16_t bitwise(uint16_t crc, const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : (crc >> 1);
+            }
+        }
+        return crc;
+    }
+
+    static uint16_t table(uint16_t crc, const uint8_t *data, size_t len) {
+        const auto &t = detail::crc16_tables[0];
+        for (size_t i = 0; i < len; i++) {
+            crc = static_cast<uint16_t>((crc >> 8) ^ t[(crc ^ data[i]) & 0xff]);
+        }
+        return crc;
+    }
+
+    static uint16_t slice8(uint16_t crc, const uint8_t *data, size_t len) {
+        const auto &t = detail::crc16_tables;
+        for (; len >= 8; data += 8, len -= 8) {
+            // the crc only reaches into the first two bytes
+            uint32_t lo = (data[0] | (data[1] << 8)) ^ crc;
+            crc = static_cast<uint16_t>(t[7][lo & 0xff] ^ t[6][lo >> 8] ^ t[5][data[2]] ^ t[4][data[3]] ^
+                                        t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]]);
+        }
+        return table(crc, data, len);
+    }
+
+  public:
+    // continues `crc` over `len` bytes at `data`
+    static uint16_t update(uint16_t crc, const void *data, size_t len, kernel with = kernel::best) {
+        auto *bytes = static_cast<const uint8_t *>(data);
+        switch (with) {
+        case kernel::bitwise:
+            return bitwise(crc, bytes, len);
+        case kernel::table:
+            return table(crc, bytes, len);
+        default:
+            return slice8(crc, bytes, len);
+        }
+    }
+
+    static uint16_t compute(const void *data, size_t len, kernel with = kernel::best) {
+        return update(initial, data, len, with);
+    }
+
+    crc16 &update(const void *data, size_t len) {
+        _crc = update(_crc, data, len);
+        return *this;
+    }
+
+    uint16_t value() const { return _crc; }
+    void reset() { _crc = initial; }
+};
+
+} // namespace rx
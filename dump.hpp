@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace rx {
+
+namespace detail {
+
+// `text` inside a double quoted string, of json or a prometheus label
+inline void escape_quoted(std::ostream &os, std::string_view text) {
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        } else if (c == '\n') {
+            os << "\\n";
+        } else {
+            os << c;
+        }
+    }
+}
+
+// `text` to the file at `path`, through a temporary file renamed into
+// place, so a reader never sees half of it
+inline bool write_file(const std::string &path, std::string_view text) {
+    std::string temporary = path + ".tmp";
+    FILE *file = std::fopen(temporary.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+    written = std::fclose(file) == 0 && written;
+    return written && std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+} // namespace detail
+
+} // namespace rx
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace rx {
+
+// epoch-based reclamation, for structures whose readers must not lock.
+// a reader pins the current epoch for as long as it holds on to shared data;
+// a writer unpublishes that data and retires it, stamped with the epoch it
+// was retired in, and it is freed once every pinned reader has moved past.
+// one process-wide domain, every thread that pins gets a slot of its own.
+class epoch_domain {
+    static constexpr uint64_t idle = std::numeric_limits<uint64_t>::max();
+
+    struct alignas(64) slot_t {
+        std::atomic<uint64_t> epoch{idle};
+        std::atomic<bool> in_use{false};
+        slot_t *next = nullptr;
+    };
+
+    struct retired_t {
+        uint64_t epoch;
+        void *ptr;
+        void (*deleter)(void *);
+    };
+
+    // per thread: its slot, and how deep it is in nested pins
+    struct local_t {
+        slot_t *slot = nullptr;
+        size_t depth = 0;
+
+        ~local_t() {
+            if (slot != nullptr) {
+                slot->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::atomic<uint64_t> _epoch{0};
+    std::atomic<slot_t *> _slots{nullptr};
+    std::mutex _mtx;
+    std::vector<retired_t> _retired;
+
+    epoch_domain() = default;
+
+    template <typename U>
+    static void delete_as(void *ptr) {
+        delete static_cast<U *>(ptr);
+    }
+
+    static local_t &local() {
+        static thread_local local_t tls_local;
+        return tls_local;
+    }
+
+    // slots are never freed, a thread that exits hands its slot on
+    slot_t *claim_slot() {
+        for (auto *slot = _slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+            bool expected = false;
+            if (!slot->in_use.load(std::memory_order_relaxed) &&
+                slot->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return slot;
+            }
+        }
+        auto *slot = new slot_t();
+        slot->in_use.store(true, std::memory_order_relaxed);
+        slot->next = _slots.load(std::memory_order_relaxed);
+        while (!_slots.compare_exchange_weak(slot->next, slot, std::memory_order_release)) {
+        }
+        return slot;
+    }
+
+    uint64_t oldest_pinned() const {
+        uint64_t oldest = idle;
+        for (auto *slot = _slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+            oldest = std::min(oldest, slot->epoch.load());
+        }
+        return oldest;
+    }
+
+  public:
+    // never destroyed, threads still running at exit may hold slots
+    static epoch_domain &instance() {
+        static auto *domain = new epoch_domain();
+        return *domain;
+    }
+
+    void enter() {
+        auto &tls = local();
+        if (tls.depth++ == 0) {
+            if (tls.slot == nullptr) {
+                tls.slot = claim_slot();
+            }
+            tls.slot->epoch.store(_epoch.load());
+        }
+    }
+
+    void exit() {
+        auto &tls = local();
+        if (--tls.depth == 0) {
+            tls.slot->epoch.store(idle, std::memory_order_release);
+        }
+    }
+
+    class guard {
+        epoch_domain *_domain;
+
+      public:
+        explicit guard(epoch_domain &domain)
+            : _domain(&domain) {
+            _domain->enter();
+        }
+        guard(const guard &) = delete;
+        guard &operator=(const guard &) = delete;
+        ~guard() { _domain->exit(); }
+    };
+
+    // keeps anything loaded from now on alive until the guard goes away
+    guard pin() { return guard(*this); }
+
+    // `ptr` must already be unreachable for new readers. it is deleted once
+    // the readers that might still see it have unpinned, possibly right away.
+    template <typename U>
+    void retire(U *ptr) {
+        if (ptr == nullptr) {
+            return;
+        }
+        auto epoch = _epoch.fetch_add(1);
+        std::vector<retired_t> ready;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _retired.push_back({epoch, ptr, &delete_as<U>});
+            auto oldest = oldest_pinned();
+            auto it = std::partition(_retired.begin(), _retired.end(), [oldest](const retired_t &r) {
+                return r.epoch >= oldest;
+            });
+            ready.assign(it, _retired.end());
+            _retired.erase(it, _retired.end());
+        }
+        for (const auto &r : ready) {
+            r.deleter(r.ptr);
+        }
+    }
+};
+
+} // namespace rx
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace rx {
+
+namespace detail {
+
+// std::hash of an integer is the integer, which would pile sequential ids
+// into one run. the murmur3 finalizer spreads them over all the bits.
+inline uint64_t mix_hash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+} // namespace detail
+
+// open addressing with linear probing over a power-of-two table: one flat
+// array, no node per entry and no tombstones, erase shifts the rest of the
+// probe run back instead. inserting or erasing invalidates pointers into it.
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class flat_hash_map {
+  public:
+    using value_type = std::pair<K, V>;
+
+  private:
+    static constexpr size_t npos = SIZE_MAX;
+
+    std::vector<std::optional<value_type>> _slots;
+    size_t _size = 0;
+    Hash _hash;
+    Eq _eq;
+
+    size_t mask() const { return _slots.size() - 1; }
+
+    size_t home(const K &key) const {
+        return static_cast<size_t>(detail::mix_hash(static_cast<uint64_t>(_hash(key)))) & mask();
+    }
+
+    size_t slot_of(const K &key) const {
+        for (size_t i = home(key);; i = (i + 1) & mask()) {
+            if (!_slots[i]) {
+                return npos;
+            }
+            if (_eq(_slots[i]->first, key)) {
+                return i;
+            }
+        }
+    }
+
+    size_t free_slot(const K &key) const {
+        size_t i = home(key);
+        while (_slots[i]) {
+            i = (i + 1) & mask();
+        }
+        return i;
+    }
+
+    void grow() {
+        std::vector<std::optional<value_type>> old(_slots.size() * 2);
+        old.swap(_slots);
+        for (auto &entry : old) {
+            if (entry) {
+                _slots[free_slot(entry->first)] = std::move(entry);
+            }
+        }
+    }
+
+    void erase_slot(size_t i) {
+        for (size_t j = (i + 1) & mask(); _slots[j]; j = (j + 1) & mask()) {
+            // `j` may fill the hole if its home isn't between the hole and it
+            size_t h = home(_slots[j]->first);
+            if (((j - h) & mask()) >= ((j - i) & mask())) {
+                _slots[i] = std::move(_slots[j]);
+                i = j;
+            }
+        }
+        _slots[i].reset();
+        _size--;
+    }
+
+  public:
+    // room for `capacity` entries before the first rehash
+    explicit flat_hash_map(size_t capacity = 16) {
+        size_t slots = 16;
+        while (slots * 3 / 4 < capacity) {
+            slots *= 2;
+        }
+        _slots.resize(slots);
+    }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    V *find(const K &key) {
+        size_t i = slot_of(key);
+        return i == npos ? nullptr : &_slots[i]->second;
+    }
+
+    // the value for `key`, constructed from `args` if there was none, and
+    // whether it was
+    template <typename... Args>
+    std::pair<V *, bool> try_emplace(const K &key, Args &&...args) {
+        size_t i = slot_of(key);
+        if (i != npos) {
+            return {&_slots[i]->second, false};
+        }
+        // at most 3/4 full, so probe runs stay short
+        if ((_size + 1) * 4 > _slots.size() * 3) {
+            grow();
+        }
+        i = free_slot(key);
+        _slots[i].emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+        _size++;
+        return {&_slots[i]->second, true};
+    }
+
+    bool erase(const K &key) {
+        size_t i = slot_of(key);
+        if (i == npos) {
+            return false;
+        }
+        erase_slot(i);
+        return true;
+    }
+
+    // erases the entries `pred(key, value)` is true for
+    template <typename Pred>
+    void erase_if(Pred &&pred) {
+        std::vector<K> doomed;
+        for (auto &entry : _slots) {
+            if (entry && pred(entry->first, entry->second)) {
+                doomed.push_back(entry->first);
+            }
+        }
+        for (const auto &key : doomed) {
+            erase(key);
+        }
+    }
+
+    template <typename F>
+    void for_each(F &&fun) {
+        for (auto &entry : _slots) {
+            if (entry) {
+                fun(entry->first, entry->second);
+            }
+        }
+    }
+
+    void clear() {
+        for (auto &entry : _slots) {
+            entry.reset();
+        }
+        _size = 0;
+    }
+};
+
+// the same table with keys only
+template <typename K, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class flat_hash_set {
+    struct empty_t {};
+
+    flat_hash_map<K, empty_t, Hash, Eq> _map;
+
+  public:
+    explicit flat_hash_set(size_t capacity = 16)
+        : _map(capacity) {}
+
+    size_t size() const { return _map.size(); }
+    bool empty() const { return _map.empty(); }
+    bool contains(const K &key) { return _map.find(key) != nullptr; }
+
+    // false if `key` was already there
+    bool insert(const K &key) { return _map.try_emplace(key).second; }
+    bool erase(const K &key) { return _map.erase(key); }
+    void clear() { _map.clear(); }
+};
+
+} // namespace rx
@@ -0,0 +1,383 @@
+#pragma once
+
+#include "rx.hpp"
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace rx {
+namespace fused {
+
+// statically typed pipelines. a source pushes every element into a sink
+// (`bool on_next(value)`, false to stop, and `on_completed()`), and every
+// operator wraps the downstream sink in its own. the whole chain is one
+// concrete type, so
+//
+//   rx::fused::range(0, n) | filter(p) | map(f) | reduce(g)
+//
+// compiles down to a single loop with no indirect calls and no allocations.
+// `as_observable()` and `from(observable)` cross back into the type-erased
+// `rx::observable<T>` world.
+
+// tag for the right-hand side of `operator|`
+struct stage {};
+
+template <typename T, typename Gen>
+class source {
+    Gen _gen;
+
+  public:
+    using value_type = T;
+
+    explicit source(Gen gen)
+        : _gen(std::move(gen)) {}
+
+    template <typename Sink>
+    void run(Sink &sink) const {
+        _gen(sink);
+    }
+
+    template <typename F>
+    void subscribe(F &&fun) const {
+        struct {
+            F &fun;
+            bool on_next(const T &value) {
+                fun(value);
+                return true;
+            }
+            void on_completed() {}
+        } sink{fun};
+        run(sink);
+    }
+
+    // stops pulling from the source once the subscription is disposed
+    auto as_observable() const {
+        return make_observable<T>([self = *this](const observer<T> &obs, const subscription &sub) {
+            struct {
+                const observer<T> &obs;
+                const subscription &sub;
+                bool on_next(const T &value) {
+                    obs(value);
+                    return !sub.is_disposed();
+                }
+                void on_completed() {}
+            } sink{obs, sub};
+            self.run(sink);
+        });
+    }
+};
+
+template <typename T, typename Gen>
+auto make_source(Gen &&gen) {
+    return source<T, std::decay_t<Gen>>(std::forward<Gen>(gen));
+}
+
+template <typename T, typename Gen, typename Stage, typename = std::enable_if_t<std::is_base_of_v<stage, Stage>>>
+auto operator|(source<T, Gen> src, const Stage &op) {
+    return op(std::move(src));
+}
+
+// sources
+
+template <typename T>
+auto range(T start, T count) {
+    return make_source<T>([start, count](auto &sink) {
+        for (T i = start; i < start + count; ++i) {
+            if (!sink.on_next(i)) {
+                break;
+            }
+        }
+        sink.on_completed();
+    });
+}
+
+template <typename T>
+auto repeat(T value, size_t count) {
+    return make_source<T>([value, count](auto &sink) {
+        for (size_t i = 0; i < count; i++) {
+            if (!sink.on_next(value)) {
+                break;
+            }
+        }
+        sink.on_completed();
+    });
+}
+
+template <typename Iterable>
+auto from(Iterable iterable) {
+    using T = typename std::remove_cv_t<std::remove_reference_t<decltype(*iterable.begin())>>;
+    return make_source<T>([iterable](auto &sink) {
+        for (const auto &value : iterable) {
+            if (!sink.on_next(value)) {
+                break;
+            }
+        }
+        sink.on_completed();
+    });
+}
+
+// a downstream stop disposes the upstream subscription. sources that don't
+// poll it may still push a few values, those are ignored.
+template <typename T>
+auto from(const shared_observable<T> &obs) {
+    return make_source<T>([obs](auto &sink) {
+        subscription sub;
+        obs->subscribe(sub, [&sink, &sub](const T &value) {
+            if (!sub.is_disposed() && !sink.on_next(value)) {
+                sub.dispose();
+            }
+        });
+        sink.on_completed();
+    });
+}
+
+template <typename T, typename Stage, typename = std::enable_if_t<std::is_base_of_v<stage, Stage>>>
+auto operator|(const shared_observable<T> &obs, const Stage &op) {
+    return op(from(obs));
+}
+
+// operators
+
+template <typename Pred>
+struct filter_stage : stage {
+    Pred pred;
+
+    template <typename T, typename Gen>
+    auto operator()(source<T, Gen> src) const {
+        return make_source<T>([src = std::move(src), pred = pred](auto &next) {
+            struct {
+                decltype(next) down;
+                const Pred &pred;
+                bool on_next(const T &value) { return !pred(value) || down.on_next(value); }
+                void on_completed() { down.on_completed(); }
+            } sink{next, pred};
+            src.run(sink);
+        });
+    }
+};
+
+template <typename Pred>
+auto filter(Pred pred) {
+    return filter_stage<Pred>{{}, std::move(pred)};
+}
+
+template <typename F>
+struct map_stage : stage {
+    F fun;
+
+    template <typename T, typename Gen>
+    auto operator()(source<T, Gen> src) const {
+        using U = std::decay_t<std::invoke_result_t<const F &, const T &>>;
+        return make_source<U>([src = std::move(src), fun = fun](auto &next) {
+            struct {
+                decltype(next) down;
+                const F &fun;
+                bool on_next(const T &value) { return down.on_next(fun(value)); }
+                void on_completed() { down.on_completed(); }
+            } sink{next, fun};
+            src.run(sink);
+        });
+    }
+};
+
+template <typename F>
+auto map(F fun) {
+    return map_stage<F>{{}, std::move(fun)};
+}
+
+struct skip_stage : stage {
+    size_t n;
+
+    template <typename T, typename Gen>
+    auto operator()(source<T, Gen> src) const {
+        return make_source<T>([src = std::move(src), n = n](auto &next) {
+            struct {
+                decltype(next) down;
+                size_t n;
+                size_t count = 0;
+                bool on_next(const T &value) { return count++ < n || down.on_next(value); }
+                void on_completed() { down.on_completed(); }
+            } sink{next, n};
+            src.run(sink);
+        });
+    }
+};
+
+inline auto skip(size_t n) { return skip_stage{{}, n}; }
+
+struct take_stage : stage {
+    size_t n;
+
+    template <typename T, typename Gen>
+    auto operator()(source<T, Gen> src) const {
+        return make_source<T>([src = std::move(src), n = n](auto &next) {
+            struct {
+                decltype(next) down;
+                size_t n;
+                size_t count = 0;
+                bool on_next(const T &value) {
+                    if (count >= n) {
+                        return false;
+                    }
+                    return down.on_next(value) && ++count < n;
+                }
+                void on_completed() { down.on_completed(); }
+            } sink{next, n};
+            src.run(sink);
+        });
+    }
+};
+
+inline auto take(size_t n) { return take_stage{{}, n}; }
+
+template <typename Pred>
+struct take_while_stage : stage {
+    Pred pred;
+
+    template <typename T, typename Gen>
+    auto operator()(source<T, Gen> src) const {
+        return make_source<T>([src = std::move(src), pred = pred](auto &next) {
+            struct {
+                decltype(next) down;
+                const Pred &pred;
+                bool on_next(const T &value) { return pred(value) && down.on_next(value); }
+                void on_completed() { down.on_completed(); }
+            } sink{next, pred};
+            src.run(sink);
+        });
+    }
+};
+
+template <typename Pred>
+auto take_while(Pred pred) {
+    return take_while_stage<Pred>{{}, std::move(pred)};
+}
+
+template <typename Pred>
+struct skip_while_stage : stage {
+    Pred pred;
+
+    template <typename T, typename Gen>
+    auto operator()(source<T, Gen> src) const {
+        return make_source<T>([src = std::move(src), pred = pred](auto &next) {
+            struct {
+                decltype(next) down;
+                const Pred &pred;
+                bool is_skipping = true;
+                bool on_next(const T &value) {
+                    if (is_skipping && pred(value)) {
+                        return true;
+                    }
+                    is_skipping = false;
+                    return down.on_next(value);
+                }
+                void on_completed() { down.on_completed(); }
+            } sink{next, pred};
+            src.run(sink);
+        });
+    }
+};
+
+template <typename Pred>
+auto skip_while(Pred pred) {
+    return skip_while_stage<Pred>{{}, std::move(pred)};
+}
+
+template <typename U, typename F>
+struct scan_stage : stage {
+    U seed;
+    F fun;
+
+    template <typename T, typename Gen>
+    auto operator()(source<T, Gen> src) const {
+        return make_source<U>([src = std::move(src), seed = seed, fun = fun](auto &next) {
+            struct {
+                decltype(next) down;
+                const F &fun;
+                U acc;
+                bool on_next(const T &value) {
+                    acc = fun(acc, value);
+                    return down.on_next(acc);
+                }
+                void on_completed() { down.on_completed(); }
+            } sink{next, fun, seed};
+            src.run(sink);
+        });
+    }
+};
+
+template <typename U, typename F>
+auto scan(U seed, F fun) {
+    return scan_stage<U, F>{{}, std::move(seed), std::move(fun)};
+}
+
+// folds the whole sequence, emits once on completion. without a seed the
+// accumulator starts at `T{0}`, like `observable::reduce`
+template <typename F, typename U = void>
+struct reduce_stage : stage {
+    F fun;
+    std::conditional_t<std::is_void_v<U>, std::nullptr_t, U> seed;
+
+    template <typename T, typename Gen>
+    auto operator()(source<T, Gen> src) const {
+        using A = std::conditional_t<std::is_void_v<U>, T, U>;
+        A init;
+        if constexpr (std::is_void_v<U>) {
+            init = A{0};
+        } else {
+            init = seed;
+        }
+        return make_source<A>([src = std::move(src), init, fun = fun](auto &next) {
+            struct {
+                decltype(next) down;
+                const F &fun;
+                A acc;
+                bool on_next(const T &value) {
+                    acc = fun(acc, value);
+                    return true;
+                }
+                void on_completed() {
+                    down.on_next(acc);
+                    down.on_completed();
+                }
+            } sink{next, fun, init};
+            src.run(sink);
+        });
+    }
+};
+
+template <typename F>
+auto reduce(F fun) {
+    return reduce_stage<F>{{}, std::move(fun), nullptr};
+}
+
+template <typename F, typename U>
+auto reduce(F fun, U seed) {
+    return reduce_stage<F, U>{{}, std::move(fun), std::move(seed)};
+}
+
+struct count_stage : stage {
+    template <typename T, typename Gen>
+    auto operator()(source<T, Gen> src) const {
+        return make_source<size_t>([src = std::move(src)](auto &next) {
+            struct {
+                decltype(next) down;
+                size_t count = 0;
+                bool on_next(const T &) {
+                    count++;
+                    return true;
+                }
+                void on_completed() {
+                    down.on_next(count);
+                    down.on_completed();
+                }
+            } sink{next};
+            src.run(sink);
+        });
+    }
+};
+
+inline auto count() { return count_stage{}; }
+
+} // namespace fused
+} // namespace rx
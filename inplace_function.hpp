@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// inline capacity (in bytes) of `rx::observer` and friends. callables that
+// fit, and are nothrow-movable, never touch the heap.
+#ifndef RX_OBSERVER_CAPACITY
+#define RX_OBSERVER_CAPACITY 56
+#endif
+
+namespace rx {
+
+template <typename Signature, size_t Capacity = RX_OBSERVER_CAPACITY>
+class inplace_function;
+
+// a std::function replacement with a fixed inline buffer. small callables
+// are stored in place; larger ones fall back to a single heap box. moving is
+// cheap in both cases, copying clones the target. it is copyable itself, so
+// move-only targets are rejected when it is made from them.
+template <typename R, typename... Args, size_t Capacity>
+class inplace_function<R(Args...), Capacity> {
+    struct vtable_t {
+        R (*invoke)(void *, Args...);
+        void (*copy)(void *, const void *);
+        void (*move)(void *, void *) noexcept;
+        void (*destroy)(void *) noexcept;
+    };
+
+    template <typename F>
+    static constexpr bool fits_inline = sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<F>;
+
+    template <typename F>
+    static F *target(void *storage) {
+        if constexpr (fits_inline<F>) {
+            return std::launder(reinterpret_cast<F *>(storage));
+        } else {
+            return *reinterpret_cast<F **>(storage);
+        }
+    }
+
+    template <typename F>
+    static const vtable_t *vtable_for() {
+        static const vtable_t vtable = {
+            [](void *storage, Args... args) -> R {
+                return (*target<F>(storage))(std::forward<Args>(args)...);
+            },
+            [](void *dst, const void *src) {
+                const F &from = *target<F>(const_cast<void *>(src));
+                if constexpr (fits_inline<F>) {
+                    ::new (dst) F(from);
+                } else {
+                    *reinterpret_cast<F **>(dst) = new F(from);
+                }
+            },
+            [](void *dst, void *src) noexcept {
+                if constexpr (fits_inline<F>) {
+                    ::new (dst) F(std::move(*target<F>(src)));
+                    target<F>(src)->~F();
+                } else {
+                    *reinterpret_cast<F **>(dst) = target<F>(src);
+                }
+            },
+            [](void *storage) noexcept {
+                if constexpr (fits_inline<F>) {
+                    target<F>(storage)->~F();
+                } else {
+                    delete target<F>(storage);
+                }
+            },
+        };
+        return &vtable;
+    }
+
+    alignas(std::max_align_t) unsigned char _storage[Capacity];
+    const vtable_t *_vtable = nullptr;
+
+  public:
+    static constexpr size_t capacity = Capacity;
+
+    inplace_function() noexcept {}
+    inplace_function(std::nullptr_t) noexcept {}
+
+    template <typename F, typename Fn = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<Fn, inplace_function> &&
+                                          std::is_invocable_r_v<R, Fn &, Args...>>>
+    inplace_function(F &&fun) {
+        static_assert(std::is_copy_constructible_v<Fn>, "inplace_function needs a copyable target");
+        if constexpr (fits_inline<Fn>) {
+            ::new (static_cast<void *>(_storage)) Fn(std::forward<F>(fun));
+        } else {
+            *reinterpret_cast<Fn **>(_storage) = new Fn(std::forward<F>(fun));
+        }
+        _vtable = vtable_for<Fn>();
+    }
+
+    inplace_function(const inplace_function &other) {
+        if (other._vtable != nullptr) {
+            other._vtable->copy(_storage, other._storage);
+            _vtable = other._vtable;
+        }
+    }
+
+    inplace_function(inplace_function &&other) noexcept {
+        if (other._vtable != nullptr) {
+            other._vtable->move(_storage, other._storage);
+            _vtable = other._vtable;
+            other._vtable = nullptr;
+        }
+    }
+
+    ~inplace_function() { reset(); }
+
+    inplace_function &operator=(const inplace_function &other) {
+        if (this != &other) {
+            inplace_function copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    inplace_function &operator=(inplace_function &&other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other._vtable != nullptr) {
+                other._vtable->move(_storage, other._storage);
+                _vtable = other._vtable;
+                other._vtable = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    inplace_function &operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    void reset() noexcept {
+        if (_vtable != nullptr) {
+            _vtable->destroy(_storage);
+            _vtable = nullptr;
+        }
+    }
+
+    explicit operator bool() const noexcept { return _vtable != nullptr; }
+
+    R operator()(Args... args) const {
+        return _vtable->invoke(const_cast<unsigned char *>(_storage), std::forward<Args>(args)...);
+    }
+};
+
+} // namespace rx
@@ -1,188 +1,12 @@
-#if 0
-
-#include <cstdint>
-#include <cstdio>
-#include <iostream>
-#include <netinet/in.h>
-
-#define MODBUS_RTU_ADDRESS 0x01
-#define MODBUS_FUNC_READ_COILS 0x01
-#define MODBUS_FUNC_READ_DISCRETE_INPUTS 0x02
-#define MODBUS_FUNC_READ_HOLDING_REGISTERS 0x03
-#define MODBUS_FUNC_READ_INPUT_REGISTERS 0x04
-#define MODBUS_FUNC_WRITE_SINGLE_COIL 0x05
-#define MODBUS_FUNC_WRITE_SINGLE_REGISTER 0x06
-#define MODBUS_FUNC_WRITE_MULTIPLE_COILS 0x0F
-#define MODBUS_FUNC_WRITE_MULTIPLE_REGISTERS 0x10
-
-
-inline uint16_t crc16_update(uint16_t crc, uint8_t data)
-{
-  crc ^= static_cast<uint16_t>(data);
-  for (int i = 0; i < 8; ++i)
-  {
-    crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
-  }
-  return crc;
-}
-
-uint16_t crc16(const uint8_t *data, size_t len)
-{
-  uint16_t crc = 0xFFFF;
-  for (size_t i = 0; i < len; ++i)
-  {
-    crc = crc16_update(crc, data[i]);
-  }
-  return crc;
-}
-
-
-
-// Modbus message parsing state
-enum { STATE_IDLE, STATE_ADDRESS, STATE_FUNCTION_CODE, STATE_DATA_LENGTH, STATE_DATA, STATE_CRC } modbus_state;
-
-template <typename InputIt, typename OutputIt>
-int modbus_parse(int slave_id, InputIt first, InputIt last, OutputIt o_first) {
-
-    OutputIt o_begin = o_first; // used to calculate buffer size
-
-    uint8_t rtu_id = (uint8_t)slave_id;
-    int len;
-
-    int state = STATE_IDLE;
-    size_t count = 0;
-
-    for (auto it = first; it != last; ++it) {
-        switch (state) {
-        case STATE_IDLE:
-            if (*it == rtu_id) {
-                *o_first++ = *it;
-                state = STATE_ADDRESS;
-            }
-            break;
-        case STATE_ADDRESS:
-            *o_first++ = *it;
-            state = STATE_FUNCTION_CODE;
-            break;
-        case STATE_FUNCTION_CODE:
-            *o_first++ = *it;
-            len        = static_cast<decltype(len)>(*it);
-            if(len > 255) {
-                return -2;
-            }
-            state      = STATE_DATA_LENGTH;
-            break;
-        case STATE_DATA_LENGTH: {
-            *o_first++ = *it;
-            if(++count >= len) {
-                state = STATE_DATA;
-            }
-            break;
-        }
-        case STATE_DATA: {
-            uint16_t calculated_crc = crc16(o_begin, 3 + count);
-            uint16_t received_crc = ntohs((*it << 8) | *(it + 1));
-            if(calculated_crc != received_crc) {
-                return -3;
-            }
-            *o_first++ = *it++;
-            *o_first++ = *it;
-
-            state = STATE_CRC;
-            break;
-        }
-
-        case STATE_CRC:
-            state = STATE_IDLE;
-            return (int)(it != last); // true if more data available
-            break;
-        default:
-            return -1;
-        }
-    }
-    return 0;
-}
-
-class ModbusParser {
-    static constexpr size_t MaxSizeOfModbusResponse = 230; // 3 byte header + max 255 bytes + crc16
-    uint8_t _buffer[MaxSizeOfModbusResponse] = { 0 };
-    off_t _off = 0;
-public:
-    void Parse(const uint8_t* buf, size_t buf_len) {
-        do {
-            int res = modbus_parse(buf, buf + buf_len, &_buffer[_off]);
-        } while(res > 0);
-
-
-    }
-};
-
-/*
-case STATE_DATA:
-buffer[*buffer_index] = data;
-(*buffer_index)++;
-if (*buffer_index >= message_length + 3) {
-    // Check for correct CRC
-    uint16_t calculated_crc = modbus_crc(buffer, message_length + 1);
-    uint16_t received_crc = (buffer[*buffer_index - 2] << 8) | buffer[*buffer_index - 1];
-    if (calculated_crc != received_crc) {
-        fprintf(stderr, "Invalid CRC: 0x%04X expected, 0x%04X received\n", calculated_crc, received_crc);
-        modbus_state = STATE_IDLE;
-        return -1;
-    }
-
-    // Process the complete message
-    // ...
-
-    modbus_state = STATE_IDLE;
-    return 0;
-}
-break;
-case STATE_CRC:
-// Handle CRC calculation and verification
-break;
-default:
-fprintf(stderr, "Invalid state: %d\n", modbus_state);
-modbus_state = STATE_IDLE;
-return -1;
-}
-
-return 0;
-}
-*/
-#include <iterator>
-#include <vector>
-
-int main(int, char **) {
-    const uint8_t buf[] = {0x01, 0x03, 0x0e, 0x41, 0xaa, 0xc1, 0xdb, 0x00, 0x00, 0x00,
-                           0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x68, 0x9a};
-
-    uint8_t res[230] = { 0 };
-    int result = modbus_parse(0x01, buf, buf + sizeof(buf), res);//std::back_inserter(res));
-
-    if(result == 0) {
-        std::cout << "all done" << std::endl;
-    }
-
-    if(result > 0) {
-        std::cout << "there's still data in the buffer" << std::endl;
-    }
-
-    if(result < 0) {
-        std::cout << "error code " << result << std::endl;
-    }
-
-
-    return 0;
-}
-
-#else
-
+#include "fused.hpp"
+#include "modbus.hpp"
 #include "refc_ptr.hpp"
 #include "rx.hpp"
 #include "subject.h"
+#include "tcp.hpp"
 #include <atomic>
 #include <chrono>
+#include <cstring>
 #include <ctime>
 #include <functional>
 #include <future>
@@ -193,6 +17,7 @@ int main(int, char **) {
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <queue>
 #include <stack>
@@ -221,54 +46,6 @@ std::string lexical_cast(const T &t) {
     return sss.str();
 }
 
-#include <iostream>
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <unistd.h>
-
-struct tcp_accept {
-    int _fd;
-    int _self;
-    tcp_accept(int fd)
-        : _fd(fd) {
-        _self = accept(_fd, nullptr, nullptr);
-        if (_self < 0)
-            perror("accept");
-    }
-
-    ~tcp_accept() { close(_self); }
-};
-
-auto tcp_listener(uint16_t port) {
-    return rx::make_observable<std::string>([port](const rx::observer<std::string> &on_next) {
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        int option = 1;
-        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
-        sockaddr_in addr = {0};
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(port);
-        if (bind(sock, (sockaddr *)&addr, sizeof(addr)) < 0)
-            perror("accept");
-        listen(sock, 5);
-        while (true) {
-            tcp_accept client(sock);
-            std::string data;
-            while (true) {
-                char buf[1024];
-                int len = read(client._self, buf, sizeof(buf));
-                if (len <= 0) {
-                    on_next("client disconnected");
-                    break;
-                }
-                on_next(std::string(buf, len));
-            }
-        }
-        throw rx::on_complete();
-        close(sock);
-    });
-}
-
 #include <fstream>
 
 int main() {
@@ -312,8 +89,8 @@ int main() {
         DEBUG_VALUE_AND_TYPE_OF(o);
     });
 
-    // tcp_listener(5557)->take(1)->subscribe(
-    //     [](const std::string &str) { DEBUG_VALUE_OF(str); });
+    // rx::tcp_listen(5557)->take(1)->subscribe(
+    //     [](const rx::tcp_chunk &chunk) { DEBUG_VALUE_OF(chunk.bytes()); });
 
     // std::ifstream ifs;
     // ifs.open("test.txt");
@@ -379,10 +156,10 @@ int main() {
             return key & 1;
         })
         ->subscribe(
-            [](const rx::shared_observable<int> &obs) {
-                DEBUG_MESSAGE("new group");
-                obs->to_iterable<std::vector<int>>()->subscribe([](auto value) {
-                    DEBUG_VALUE_AND_TYPE_OF(value);
+            [](const auto &group) {
+                DEBUG_VALUE_OF(group->key());
+                group->subscribe([key = group->key()](int value) {
+                    DEBUG_MESSAGE(std::to_string(key) + ": " + std::to_string(value));
                 });
             },
             []() {
@@ -409,12 +186,175 @@ int main() {
     rx::from(times)
         ->flat_map<int>([](const auto &time) {
             return rx::of(time.first)->delay(time.second);
-        }) // 0, 2, 4
+        }) // 0, 4, 2, 1, 3
         ->debounce(500ms)
         ->subscribe([](auto value) {
             DEBUG_VALUE_OF(value);
         });
+    DEBUG_MESSAGE("-merge.concat.zip------------");
+    rx::merge(rx::of(1)->delay(50ms), rx::of(2)->delay(10ms))->subscribe([](int value) {
+        DEBUG_VALUE_OF(value);
+    });
+    rx::concat(rx::of(1)->delay(50ms), rx::of(2)->delay(10ms))->subscribe([](int value) {
+        DEBUG_VALUE_OF(value);
+    });
+    rx::zip(rx::range(1, 3), rx::of('a', 'b', 'c', 'd'))->subscribe([](const auto &row) {
+        DEBUG_VALUE_OF(row);
+    });
+    rx::combine_latest(rx::of(1)->delay(10ms), rx::of(10, 20)->delay(30ms))->subscribe([](const auto &row) {
+        DEBUG_VALUE_OF(row);
+    });
 #endif
+    DEBUG_MESSAGE("-subscribe_on.observe_on-----");
+    rx::range(1, 10)
+        ->subscribe_on(rx::schedulers::current_thread())
+        ->observe_on(rx::schedulers::thread_pool())
+        ->map([](auto value) {
+            return value * 2;
+        })
+        ->reduce([](auto acc, auto value) {
+            return acc + value;
+        })
+        ->subscribe([](int sum) {
+            DEBUG_VALUE_OF(sum);
+        });
+    DEBUG_MESSAGE("-parallel_map----------------");
+    // squared two at a time on the pool, still in order
+    rx::range(1, 6)
+        ->parallel_map(
+            [](int value) {
+                return value * value;
+            },
+            4, 2)
+        ->subscribe([](int value) {
+            DEBUG_VALUE_OF(value);
+        });
+    DEBUG_MESSAGE("-fused-----------------------");
+    (rx::fused::range(1, 10) | rx::fused::filter([](int value) {
+         return value & 1;
+     }) | rx::fused::map([](int value) {
+         return value * value;
+     }) | rx::fused::reduce([](int acc, int value) {
+         return acc + value;
+     }))
+        .subscribe([](int sum_of_odd_squares) {
+            DEBUG_VALUE_OF(sum_of_odd_squares);
+        });
+    DEBUG_MESSAGE("-concurrent_subject----------");
+    concurrent_subject<int> ticks;
+    std::atomic<int> received{0};
+    auto tick_sub = ticks.subscribe([&received](int) {
+        received++;
+    });
+    std::vector<std::thread> producers;
+    for (int i = 0; i < 4; i++) {
+        producers.emplace_back([&ticks] {
+            for (int n = 0; n < 1000; n++) {
+                ticks.on_next(n);
+            }
+        });
+    }
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    tick_sub.dispose();
+    ticks.on_next(-1);
+    DEBUG_VALUE_OF(received.load());
+    DEBUG_MESSAGE("-hot.upstream----------------");
+    // subscribing to a subject returns before anything arrives, the
+    // operators' state has to outlive those calls
+    subject<int> clicks;
+    clicks.take(2)->subscribe([](int taken) {
+        DEBUG_VALUE_OF(taken);
+    });
+    clicks.skip(3)->subscribe([](int not_skipped) {
+        DEBUG_VALUE_OF(not_skipped);
+    });
+    clicks
+        .map([](int x) {
+            return x * 10;
+        })
+        ->take(1)
+        ->subscribe([](int mapped_then_taken) {
+            DEBUG_VALUE_OF(mapped_then_taken);
+        });
+    clicks.first()->subscribe([](int first_click) {
+        DEBUG_VALUE_OF(first_click);
+    });
+    clicks
+        .skip_while([](int x) {
+            return x < 4;
+        })
+        ->subscribe([](int after_skip_while) {
+            DEBUG_VALUE_OF(after_skip_while);
+        });
+    clicks.average()->subscribe([](int running_average) {
+        DEBUG_VALUE_OF(running_average);
+    });
+    clicks.buffer_with_count(2)->subscribe([](const rx::pooled_vector<int> &pair) {
+        DEBUG_VALUE_OF(pair.size());
+    });
+    clicks.window_with_count(3, 1)->subscribe([](const rx::slab_view<int> &window) {
+        DEBUG_VALUE_OF(window.size());
+    });
+    for (int click = 1; click <= 4; click++) {
+        clicks.on_next(click);
+    }
+    // groups are hot too, and end with their upstream
+    rx::range(1, 6)
+        ->group_by([](int x) {
+            return x % 2;
+        })
+        ->subscribe([](const auto &group) {
+            group->count()->subscribe([](size_t in_group) {
+                DEBUG_VALUE_OF(in_group);
+            });
+            group->max()->subscribe([](int group_max) {
+                DEBUG_VALUE_OF(group_max);
+            });
+        });
+    DEBUG_MESSAGE("-backpressure----------------");
+    auto demand = rx::subscription::with_demand(3);
+    rx::range(1, 1000)->on_backpressure_drop()->subscribe(demand, [](int not_dropped) {
+        DEBUG_VALUE_OF(not_dropped);
+    });
+    DEBUG_MESSAGE("-modbus----------------------");
+    // a read reply behind two bytes of line noise, split across two reads
+    auto pool = make_refc_ptr<rx::buffer_pool>(64);
+    auto block = pool->acquire();
+    const uint8_t reply[] = {0x55, 0xff, 0x01, 0x03, 0x0e, 0x41, 0xaa, 0xc1, 0xdb, 0x00, 0x00, 0x00,
+                             0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x68, 0x9a};
+    std::memcpy(block->data(), reply, sizeof(reply));
+    std::vector<rx::buffer_slice> reads = {{block, {block->data(), 9}},
+                                           {block, {block->data() + 9, sizeof(reply) - 9}}};
+    rx::modbus::decode_rtu(rx::from(reads))->subscribe([](const rx::modbus::frame &frame) {
+        DEBUG_VALUE_OF(static_cast<int>(frame.address()));
+        DEBUG_VALUE_OF(static_cast<int>(frame.function()));
+        DEBUG_VALUE_OF(frame.data().size());
+    });
+    // two write replies, each split 3 + 5, held on to until both are in:
+    // the first keeps its bytes while the second is put back together
+    std::vector<rx::buffer_slice> splits;
+    const std::pair<uint8_t, const char *> writes[] = {{1, "ab"}, {2, "cd"}};
+    for (const auto &[address, data] : writes) {
+        auto write = pool->acquire();
+        auto *adu = reinterpret_cast<uint8_t *>(write->data());
+        const uint8_t head[] = {address, 0x06, 0x00, 0x10};
+        std::memcpy(adu, head, sizeof(head));
+        std::memcpy(adu + 4, data, 2);
+        uint16_t crc = rx::crc16::compute(adu, 6);
+        adu[6] = static_cast<uint8_t>(crc & 0xff);
+        adu[7] = static_cast<uint8_t>(crc >> 8);
+        splits.push_back({write, {write->data(), 3}});
+        splits.push_back({write, {write->data() + 3, 5}});
+    }
+    std::vector<rx::modbus::frame> kept;
+    rx::modbus::decode_rtu(rx::from(splits))->subscribe([&kept](const rx::modbus::frame &frame) {
+        kept.push_back(frame);
+    });
+    for (const auto &frame : kept) {
+        DEBUG_VALUE_OF(static_cast<int>(frame.address()));
+        DEBUG_VALUE_OF(frame.data().substr(2));
+    }
     return 0;
 }
-#endif
@@ -0,0 +1,436 @@
+#pragma once
+
+// per stage counters for running chains, opt-in: define RX_METRICS before
+// including rx.hpp (or for the whole build). without it the hooks in rx.hpp
+// compile to nothing and only the types here remain.
+//
+// every observable is a stage, named after the function that made it and,
+// for operators, after its upstream: `range/filter/map`. chains built the
+// same way share their counters, `named("decode")` sets a name of one's own.
+// a stage counts the elements it took in and gave out, the time spent in
+// its own callbacks (not counting what it passed downstream on the same
+// thread), how often it was subscribed and, for operators that queue, how
+// deep the queue got. with RX_METRICS_OPERATOR_NEW defined in one
+// translation unit it also counts the allocations made in its callbacks.
+// with RX_TRACE the same hooks record a timeline, see trace.hpp.
+//
+//     rx::metrics::registry::instance().write("/tmp/rx.prom");
+//     auto server = rx::metrics::registry::instance().serve("/tmp/rx.sock");
+
+#include "dump.hpp"
+#include "subscription.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+namespace rx {
+
+namespace metrics {
+
+struct stage {
+    const std::string name;
+    std::atomic<uint64_t> subscriptions{0};
+    std::atomic<uint64_t> elements_in{0};
+    std::atomic<uint64_t> elements_out{0};
+    std::atomic<uint64_t> busy_ns{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> queue_depth{0};
+    std::atomic<uint64_t> max_queue_depth{0};
+
+    explicit stage(std::string name)
+        : name(std::move(name)) {}
+
+    void record_queue(uint64_t depth) {
+        queue_depth.store(depth, std::memory_order_relaxed);
+        uint64_t max = max_queue_depth.load(std::memory_order_relaxed);
+        while (depth > max && !max_queue_depth.compare_exchange_weak(max, depth, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+// for sending the events elsewhere as well, a tracer say. called on the
+// thread the event happened on, so keep them cheap.
+class hooks {
+  public:
+    virtual ~hooks() = default;
+
+    virtual void on_subscribe(stage &) {}
+    // `to` is null for the final observer
+    virtual void on_next(stage &, stage *, size_t, uint64_t) {}
+    virtual void on_queue(stage &, uint64_t) {}
+};
+
+enum class format { prometheus, json };
+
+class registry {
+    std::mutex _mtx;
+    // stages are never removed, so the pointers handed out stay valid
+    std::map<std::string, std::unique_ptr<stage>> _stages;
+    std::atomic<hooks *> _hooks{nullptr};
+
+  public:
+    static registry &instance() {
+        static registry *instance = new registry(); // outlives static destructors
+        return *instance;
+    }
+
+    stage *get(const std::string &name) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto &found = _stages[name];
+        if (!found) {
+            found = std::make_unique<stage>(name);
+        }
+        return found.get();
+    }
+
+    template <typename F>
+    void for_each(F &&fun) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        for (auto &entry : _stages) {
+            fun(*entry.second);
+        }
+    }
+
+    // zeroes every counter, the stages stay
+    void reset() {
+        for_each([](stage &s) {
+            s.subscriptions = 0;
+            s.elements_in = 0;
+            s.elements_out = 0;
+            s.busy_ns = 0;
+            s.allocations = 0;
+            s.queue_depth = 0;
+            s.max_queue_depth = 0;
+        });
+    }
+
+    void install(hooks *with) { _hooks.store(with, std::memory_order_release); }
+    hooks *installed() const { return _hooks.load(std::memory_order_acquire); }
+
+    std::string prometheus() {
+        struct metric {
+            const char *name;
+            const char *type;
+            const char *help;
+            double (*value)(const stage &);
+        };
+        static const metric all[] = {
+            {"rx_stage_subscriptions_total", "counter", "times the stage was subscribed",
+             [](const stage &s) {
+                 return static_cast<double>(s.subscriptions.load());
+             }},
+            {"rx_stage_elements_in_total", "counter", "elements the stage took in",
+             [](const stage &s) {
+                 return static_cast<double>(s.elements_in.load());
+             }},
+            {"rx_stage_elements_out_total", "counter", "elements the stage passed on",
+             [](const stage &s) {
+                 return static_cast<double>(s.elements_out.load());
+             }},
+            {"rx_stage_busy_seconds_total", "counter", "time spent in the stage itself",
+             [](const stage &s) {
+                 return static_cast<double>(s.busy_ns.load()) / 1e9;
+             }},
+            {"rx_stage_allocations_total", "counter", "allocations made in the stage",
+             [](const stage &s) {
+                 return static_cast<double>(s.allocations.load());
+             }},
+            {"rx_stage_queue_depth", "gauge", "elements queued in the stage",
+             [](const stage &s) {
+                 return static_cast<double>(s.queue_depth.load());
+             }},
+            {"rx_stage_queue_depth_max", "gauge", "most elements queued in the stage at once",
+             [](const stage &s) {
+                 return static_cast<double>(s.max_queue_depth.load());
+             }},
+        };
+        std::ostringstream os;
+        os << std::setprecision(15);
+        for (const auto &m : all) {
+            os << "# HELP " << m.name << ' ' << m.help << "\n# TYPE " << m.name << ' ' << m.type << '\n';
+            for_each([&os, &m](const stage &s) {
+                os << m.name << "{stage=\"";
+                rx::detail::escape_quoted(os, s.name);
+                os << "\"} " << m.value(s) << '\n';
+            });
+        }
+        return os.str();
+    }
+
+    std::string json() {
+        std::ostringstream os;
+        os << "{\"stages\": [";
+        const char *separator = "\n  ";
+        for_each([&os, &separator](const stage &s) {
+            os << separator << "{\"name\": \"";
+            rx::detail::escape_quoted(os, s.name);
+            os << "\", \"subscriptions\": " << s.subscriptions.load() << ", \"elements_in\": " << s.elements_in.load()
+               << ", \"elements_out\": " << s.elements_out.load() << ", \"busy_ns\": " << s.busy_ns.load()
+               << ", \"allocations\": " << s.allocations.load() << ", \"queue_depth\": " << s.queue_depth.load()
+               << ", \"max_queue_depth\": " << s.max_queue_depth.load() << "}";
+            separator = ",\n  ";
+        });
+        os << "\n]}\n";
+        return os.str();
+    }
+
+    std::string dump(format as) { return as == format::json ? json() : prometheus(); }
+
+    // through a temporary file renamed into place, so a reader never sees
+    // half of it
+    bool write(const std::string &path, format as = format::prometheus) {
+        return rx::detail::write_file(path, dump(as));
+    }
+
+    // answers every connection to the unix socket at `path` with a dump
+    // and closes it (`socat - UNIX-CONNECT:path`), until disposed
+    subscription serve(const std::string &path, format as = format::prometheus) {
+        subscription sub;
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            sub.dispose();
+            return sub;
+        }
+        std::copy(path.begin(), path.end(), addr.sun_path);
+        int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(path.c_str());
+        if (sock < 0 || bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(sock, 8) < 0) {
+            if (sock >= 0) {
+                close(sock);
+            }
+            sub.dispose();
+            return sub;
+        }
+        auto server = std::make_shared<std::thread>([this, sock, as] {
+            int client;
+            while ((client = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+                std::string text = dump(as);
+                for (size_t sent = 0; sent < text.size();) {
+                    ssize_t n = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+                    if (n <= 0) {
+                        break;
+                    }
+                    sent += static_cast<size_t>(n);
+                }
+                close(client);
+            }
+        });
+        // shutting the socket down fails the pending accept
+        sub.add([server, sock, path] {
+            shutdown(sock, SHUT_RDWR);
+            server->join();
+            close(sock);
+            unlink(path.c_str());
+        });
+        return sub;
+    }
+};
+
+namespace detail {
+
+// the stage whose code runs on this thread: its subscribe callback, or its
+// observer while an element is handed to it
+inline stage *&running() {
+    static thread_local stage *tls_running = nullptr;
+    return tls_running;
+}
+
+// what the stages called from the running one took, to be taken off its time
+inline uint64_t *&nested_ns() {
+    static thread_local uint64_t *tls_nested = nullptr;
+    return tls_nested;
+}
+
+inline uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+} // namespace detail
+
+// makes `self` the running stage until the end of the scope, for its
+// subscribe callback. the stage that was running is the one subscribing.
+class subscribe_scope {
+    stage *_outer;
+    trace::span _span;
+
+  public:
+    explicit subscribe_scope(stage *self)
+        : _outer(detail::running())
+        , _span(self != nullptr ? self->name.c_str() : "subscribe", "subscribe") {
+        detail::running() = self;
+        if (self != nullptr) {
+            self->subscriptions.fetch_add(1, std::memory_order_relaxed);
+            if (auto *with = registry::instance().installed()) {
+                with->on_subscribe(*self);
+            }
+        }
+    }
+    ~subscribe_scope() { detail::running() = _outer; }
+
+    subscribe_scope(const subscribe_scope &) = delete;
+    subscribe_scope &operator=(const subscribe_scope &) = delete;
+
+    // whoever subscribed, and so gets the elements
+    stage *subscriber() const { return _outer; }
+};
+
+// times `count` elements going from `from` to `to` while in scope. the time
+// `to` spent passing them further on is not its own.
+class delivery {
+    stage *_from;
+    stage *_to;
+    size_t _count;
+    stage *_outer;
+    uint64_t *_outer_nested;
+    uint64_t _nested = 0;
+    uint64_t _start;
+    trace::span _span;
+
+  public:
+    delivery(stage *from, stage *to, size_t count)
+        : _from(from)
+        , _to(to)
+        , _count(count)
+        , _outer(detail::running())
+        , _outer_nested(detail::nested_ns())
+        , _span(to != nullptr ? to->name.c_str() : "observer", "next", count) {
+        detail::running() = to;
+        detail::nested_ns() = &_nested;
+        _start = detail::now_ns();
+    }
+
+    ~delivery() {
+        uint64_t took = detail::now_ns() - _start;
+        detail::running() = _outer;
+        detail::nested_ns() = _outer_nested;
+        if (_outer_nested != nullptr) {
+            *_outer_nested += took;
+        }
+        if (_from != nullptr) {
+            _from->elements_out.fetch_add(_count, std::memory_order_relaxed);
+        }
+        if (_to != nullptr) {
+            _to->elements_in.fetch_add(_count, std::memory_order_relaxed);
+            _to->busy_ns.fetch_add(took > _nested ? took - _nested : 0, std::memory_order_relaxed);
+        }
+        if (_from != nullptr) {
+            if (auto *with = registry::instance().installed()) {
+                with->on_next(*_from, _to, _count, took);
+            }
+        }
+    }
+
+    delivery(const delivery &) = delete;
+    delivery &operator=(const delivery &) = delete;
+};
+
+// the name a stage gets from the function that made it: `filter`, not
+// `filter<main()::<lambda(int)> >`
+inline std::string function_name(const char *function) {
+    std::string name(function);
+    return name.substr(0, name.find('<'));
+}
+
+// for the replacement operator new, see RX_METRICS_OPERATOR_NEW
+inline void note_allocation() {
+    if (auto *running = detail::running()) {
+        running->allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// the depth of an operator's queue, reported against the stage that is
+// subscribing when it is made. nothing without RX_METRICS.
+#ifdef RX_METRICS
+class queue_gauge {
+    metrics::stage *_stage = metrics::detail::running();
+
+  public:
+    void set(uint64_t depth) const {
+        if (_stage == nullptr) {
+            return;
+        }
+        _stage->record_queue(depth);
+        if (auto *with = metrics::registry::instance().installed()) {
+            with->on_queue(*_stage, depth);
+        }
+    }
+};
+#else
+class queue_gauge {
+  public:
+    void set(uint64_t) const {}
+};
+#endif
+
+
+// the running stage, carried over to the thread an operator subscribes on
+// (flat_map's inner sequences, subscribe_on), so the elements it gets there
+// still count as its own. made where the stage runs, `resume`d on the other
+// thread.
+#ifdef RX_METRICS
+class context {
+    stage *_stage = detail::running();
+
+  public:
+    class resume {
+        stage *_outer;
+
+      public:
+        explicit resume(const context &from)
+            : _outer(detail::running()) {
+            detail::running() = from._stage;
+        }
+        ~resume() { detail::running() = _outer; }
+
+        resume(const resume &) = delete;
+        resume &operator=(const resume &) = delete;
+    };
+};
+#else
+class context {
+  public:
+    class resume {
+      public:
+        explicit resume(const context &) {}
+    };
+};
+#endif
+
+} // namespace metrics
+
+} // namespace rx
+
+// counting replacements for the global operator new, for exactly one
+// translation unit of a program built with RX_METRICS
+#if defined(RX_METRICS) && defined(RX_METRICS_OPERATOR_NEW)
+void *operator new(size_t size) {
+    rx::metrics::note_allocation();
+    if (void *p = std::malloc(size != 0 ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+#endif
@@ -0,0 +1,284 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "crc16.hpp"
+#include "rx.hpp"
+#include "tcp.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+namespace rx {
+namespace modbus {
+
+enum function : uint8_t {
+    read_coils = 0x01,
+    read_discrete_inputs = 0x02,
+    read_holding_registers = 0x03,
+    read_input_registers = 0x04,
+    write_single_coil = 0x05,
+    write_single_register = 0x06,
+    write_multiple_coils = 0x0f,
+    write_multiple_registers = 0x10,
+};
+
+// what a decoder is fed: the replies a master reads, or the requests a
+// slave reads. the two lay out the same function codes differently.
+enum class kind { responses, requests };
+
+// address, function code, up to 252 bytes of data and the crc
+constexpr size_t max_adu = 256;
+
+// a frame that passed its crc. `adu` is the frame as received, a slice of
+// the block it was read into, so it costs no copy and stays valid for as
+// long as the frame (or a copy) is kept.
+struct frame {
+    uint64_t connection = 0; // set when decoded from `tcp_listen`
+    buffer_slice adu;
+
+    uint8_t address() const { return byte(0); }
+    uint8_t function() const { return byte(1) & 0x7f; }
+    bool is_exception() const { return (byte(1) & 0x80) != 0; }
+    // what follows the function code, without the crc. for an exception
+    // that is the exception code.
+    std::string_view data() const { return adu.bytes.substr(2, adu.size() - 4); }
+
+  private:
+    uint8_t byte(size_t i) const { return static_cast<uint8_t>(adu.bytes[i]); }
+};
+
+namespace detail {
+
+constexpr size_t need_more = 0;
+constexpr size_t invalid = SIZE_MAX;
+
+// the length of the frame starting at `p` as far as its first `n` bytes
+// tell, `need_more` if they don't tell yet, `invalid` if no frame starts
+// there. rtu has no delimiters, the header is all there is to resync on.
+inline size_t frame_length(const uint8_t *p, size_t n, kind of) {
+    if (n < 1) {
+        return need_more;
+    }
+    if (p[0] > 247 || (of == kind::responses && p[0] == 0)) {
+        return invalid; // 0 is broadcast, which gets no reply
+    }
+    if (n < 2) {
+        return need_more;
+    }
+    uint8_t fc = p[1];
+    if (of == kind::responses) {
+        if (fc & 0x80) {
+            return (fc & 0x7f) != 0 ? 5 : invalid;
+        }
+        switch (fc) {
+        case read_coils:
+        case read_discrete_inputs:
+        case read_holding_registers:
+        case read_input_registers:
+            if (n < 3) {
+                return need_more;
+            }
+            // registers come in pairs of bytes
+            if (p[2] == 0 || p[2] > max_adu - 5 || (fc >= read_holding_registers && p[2] % 2 != 0)) {
+                return invalid;
+            }
+            return 5 + p[2];
+        case write_single_coil:
+        case write_single_register:
+        case write_multiple_coils:
+        case write_multiple_registers:
+            return 8;
+        default:
+            return invalid;
+        }
+    }
+    switch (fc) {
+    case read_coils:
+    case read_discrete_inputs:
+    case read_holding_registers:
+    case read_input_registers:
+    case write_single_coil:
+    case write_single_register:
+        return 8;
+    case write_multiple_coils:
+    case write_multiple_registers:
+        if (n < 7) {
+            return need_more;
+        }
+        if (p[6] == 0 || p[6] > max_adu - 9) {
+            return invalid;
+        }
+        return 9 + p[6];
+    default:
+        return invalid;
+    }
+}
+
+} // namespace detail
+
+// splits a byte stream into crc checked frames. frames that arrive in one
+// piece are emitted as slices of the chunk they came in; only the bytes
+// around a split are copied, into a block of `pool` (at least 2 * max_adu
+// bytes), where they wait for the rest. after garbage or a bad crc it skips
+// one byte and tries again, so it locks back on at the next frame. a header
+// that claims more bytes than have arrived is skipped too if a whole valid
+// frame follows it, so noise can't hold back a reply until the next one.
+class rtu_decoder {
+    kind _of;
+    refc_ptr<buffer_pool> _pool;
+    // bytes waiting for the rest of their frame, [_begin, _end) of _spill
+    buffer_pool::buffer _spill;
+    size_t _begin = 0;
+    size_t _end = 0;
+    size_t _discarded = 0;
+
+    const uint8_t *pending() const { return reinterpret_cast<const uint8_t *>(_spill->data()) + _begin; }
+    size_t pending_size() const { return _end - _begin; }
+
+    void append(const uint8_t *p, size_t n) {
+        // bytes are only ever added past `_end`, and a full block is
+        // replaced rather than compacted, so frames handed out keep theirs
+        if (!_spill || _spill->capacity() - _end < n) {
+            auto fresh = _pool->acquire();
+            if (_spill) {
+                std::memcpy(fresh->data(), _spill->data() + _begin, pending_size());
+            }
+            _end = pending_size();
+            _begin = 0;
+            _spill = std::move(fresh);
+        }
+        std::memcpy(_spill->data() + _end, p, n);
+        _end += n;
+    }
+
+    // nothing is pending any more. the block is only written from the start
+    // again if no frame handed out of it is still held, otherwise the next
+    // split frame goes into a fresh one.
+    void rewind() {
+        _begin = _end = 0;
+        if (_spill && _spill->count.load(std::memory_order_acquire) > 1) {
+            _spill = buffer_pool::buffer();
+        }
+    }
+
+    static bool valid(const uint8_t *p, size_t len) { return crc16::compute(p, len) == 0; }
+
+    // the offset of the first whole valid frame after the start of `p`, 0 if
+    // there is none
+    size_t next_frame(const uint8_t *p, size_t n) const {
+        for (size_t i = 1; i < n; i++) {
+            size_t len = detail::frame_length(p + i, n - i, _of);
+            if (len != detail::invalid && len != detail::need_more && len <= n - i && valid(p + i, len)) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
+    // emits the frames in `n` bytes at `p`, which lie in `buffer`. returns
+    // how many bytes it is done with, the rest is the start of a frame.
+    template <typename Emit>
+    size_t scan(const buffer_pool::buffer &buffer, const uint8_t *p, size_t n, Emit &emit) {
+        size_t i = 0;
+        while (i < n) {
+            size_t len = detail::frame_length(p + i, n - i, _of);
+            size_t skip = 1;
+            if (len == detail::need_more || (len != detail::invalid && len > n - i)) {
+                skip = next_frame(p + i, n - i);
+                if (skip == 0) {
+                    break;
+                }
+            } else if (len != detail::invalid && valid(p + i, len)) {
+                emit(buffer_slice{buffer, {reinterpret_cast<const char *>(p + i), len}});
+                i += len;
+                continue;
+            }
+            i += skip;
+            _discarded += skip;
+        }
+        return i;
+    }
+
+  public:
+    explicit rtu_decoder(kind of = kind::responses, refc_ptr<buffer_pool> pool = make_refc_ptr<buffer_pool>(4096))
+        : _of(of)
+        , _pool(std::move(pool)) {}
+
+    // bytes skipped while resynchronizing
+    size_t discarded() const { return _discarded; }
+
+    // drops a partial frame, e.g. when its connection closes
+    void reset() {
+        _discarded += pending_size();
+        rewind();
+    }
+
+    // calls `emit(buffer_slice)` for each frame completed by `chunk`
+    template <typename Emit>
+    void push(const buffer_slice &chunk, Emit &&emit) {
+        auto *p = reinterpret_cast<const uint8_t *>(chunk.data());
+        size_t n = chunk.size();
+
+        // a frame is at most `max_adu` bytes, so that much more settles
+        // whatever was left over. once the scan gets past the leftover bytes
+        // it carries on in the chunk itself.
+        while (pending_size() > 0 && n > 0) {
+            size_t left = pending_size();
+            size_t take = std::min(n, max_adu);
+            append(p, take);
+            size_t done = scan(_spill, pending(), pending_size(), emit);
+            if (done >= left) {
+                p += done - left;
+                n -= done - left;
+                rewind();
+                break;
+            }
+            _begin += done;
+            p += take;
+            n -= take;
+        }
+        if (pending_size() > 0) {
+            return;
+        }
+        size_t done = scan(chunk.buffer, p, n, emit);
+        if (done < n) {
+            append(p + done, n - done);
+        }
+    }
+};
+
+// the frames in a byte stream, e.g. from a serial port or a single gateway
+inline auto decode_rtu(const shared_observable<buffer_slice> &chunks, kind of = kind::responses,
+                       refc_ptr<buffer_pool> pool = make_refc_ptr<buffer_pool>(4096)) {
+    return make_observable<frame>([chunks, of, pool](const observer<frame> &on_next, const subscription &sub) {
+        rtu_decoder decoder(of, pool);
+        chunks->subscribe(sub.unbounded_child(), [&decoder, &on_next](const buffer_slice &chunk) {
+            decoder.push(chunk, [&on_next](buffer_slice &&adu) {
+                on_next(frame{0, std::move(adu)});
+            });
+        });
+    });
+}
+
+// the same for every connection of a `tcp_listen` source, each with a
+// decoder of its own. a partial frame is dropped when its connection closes.
+inline auto decode_rtu(const shared_observable<tcp_chunk> &chunks, kind of = kind::responses,
+                       refc_ptr<buffer_pool> pool = make_refc_ptr<buffer_pool>(4096)) {
+    return make_observable<frame>([chunks, of, pool](const observer<frame> &on_next, const subscription &sub) {
+        std::unordered_map<uint64_t, rtu_decoder> decoders;
+        chunks->subscribe(sub.unbounded_child(), [&decoders, &on_next, of, &pool](const tcp_chunk &chunk) {
+            if (chunk.closed()) {
+                decoders.erase(chunk.connection);
+                return;
+            }
+            auto &decoder = decoders.try_emplace(chunk.connection, of, pool).first->second;
+            decoder.push(chunk.slice, [&on_next, &chunk](buffer_slice &&adu) {
+                on_next(frame{chunk.connection, std::move(adu)});
+            });
+        });
+    });
+}
+
+} // namespace modbus
+} // namespace rx
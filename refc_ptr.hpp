@@ -1,101 +1,240 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// counting policies. `refc_atomic` is safe to share across threads,
+// `refc_local` is a plain integer for chains that never leave one thread.
+struct refc_atomic {
+    using count_type = std::atomic<long>;
+    static void increment(count_type &count) { count.fetch_add(1, std::memory_order_relaxed); }
+    static bool decrement(count_type &count) { return count.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+};
+
+struct refc_local {
+    using count_type = long;
+    static void increment(count_type &count) { ++count; }
+    static bool decrement(count_type &count) { return --count == 0; }
+};
+
+// the shared count, plus how to tear down whatever it guards
+template <typename Policy>
+struct refc_block {
+    typename Policy::count_type count{0};
+    void (*dispose)(refc_block *) = nullptr;
+};
+
+template <typename T, typename Policy>
+class refc_ptr;
+
+namespace detail {
+
+template <typename T, typename = void>
+struct refc_policy_of {
+    using type = refc_atomic;
+};
 
 template <typename T>
+struct refc_policy_of<T, std::void_t<typename T::refc_policy>> {
+    using type = typename T::refc_policy;
+};
+
+} // namespace detail
+
+template <typename T, typename Policy = typename detail::refc_policy_of<T>::type, typename... Args>
+refc_ptr<T, Policy> make_refc_ptr(Args &&...args);
+
+// intrusive mode: the object carries its own count, so owning it costs no
+// extra allocation and it can hand out new references to itself. objects
+// that were never owned by a refc_ptr (e.g. on the stack) hand out nulls.
+template <typename T, typename Policy = refc_atomic>
+class enable_refc_from_this : public refc_block<Policy> {
+  public:
+    using refc_policy = Policy;
+
+    enable_refc_from_this() = default;
+    // a copy is a new object with its own count
+    enable_refc_from_this(const enable_refc_from_this &) {}
+    enable_refc_from_this &operator=(const enable_refc_from_this &) { return *this; }
+
+    refc_ptr<T, Policy> refc_from_this() const {
+        if (this->dispose == nullptr) {
+            return {};
+        }
+        auto *self = const_cast<enable_refc_from_this *>(this);
+        return refc_ptr<T, Policy>(static_cast<T *>(self), self);
+    }
+};
+
+namespace detail {
+
+template <typename T, typename Policy>
+constexpr bool is_intrusive = std::is_base_of_v<refc_block<Policy>, T>;
+
+// control block for an object adopted from a raw pointer
+template <typename T, typename Policy>
+struct refc_separate : refc_block<Policy> {
+    T *object;
+
+    explicit refc_separate(T *ptr)
+        : object(ptr) {
+        this->dispose = [](refc_block<Policy> *block) {
+            auto *self = static_cast<refc_separate *>(block);
+            delete self->object;
+            delete self;
+        };
+    }
+};
+
+// control block and object in one allocation, see make_refc_ptr
+template <typename T, typename Policy>
+struct refc_inplace : refc_block<Policy> {
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    T *object() { return std::launder(reinterpret_cast<T *>(storage)); }
+
+    refc_inplace() {
+        this->dispose = [](refc_block<Policy> *block) {
+            auto *self = static_cast<refc_inplace *>(block);
+            self->object()->~T();
+            delete self;
+        };
+    }
+};
+
+} // namespace detail
+
+template <typename T, typename Policy = typename detail::refc_policy_of<T>::type>
 class refc_ptr {
+    using block_t = refc_block<Policy>;
+
     T *_ptr;
-    std::atomic<int> *_count; // pointer for reference-count sharing
-  public:
-    refc_ptr()
-        : _ptr(nullptr)
-        , _count(nullptr) {}
-    refc_ptr(T *ptr)
+    block_t *_block;
+
+    template <typename, typename>
+    friend class refc_ptr;
+    template <typename, typename>
+    friend class enable_refc_from_this;
+    template <typename Y, typename P, typename... Args>
+    friend refc_ptr<Y, P> make_refc_ptr(Args &&...args);
+
+    // shares `block`, taking a new reference
+    refc_ptr(T *ptr, block_t *block)
         : _ptr(ptr)
-        , _count(ptr ? new std::atomic<int>(1) : nullptr) {}
-    refc_ptr(const refc_ptr &other)
-        : _ptr(other._ptr)
-        , _count(other._count) {
-        if (_count != nullptr) {
-            _count->fetch_add(1);
-        }
+        , _block(block) {
+        retain();
     }
 
     template <typename Y>
+    void adopt(Y *ptr) {
+        if (ptr == nullptr) {
+            return;
+        }
+        if constexpr (detail::is_intrusive<T, Policy>) {
+            _block = static_cast<block_t *>(_ptr);
+            if (_block->dispose == nullptr) {
+                _block->dispose = [](block_t *block) {
+                    delete static_cast<T *>(block);
+                };
+            }
+        } else {
+            _block = new detail::refc_separate<Y, Policy>(ptr);
+        }
+        retain();
+    }
+
+    void retain() {
+        if (_block != nullptr) {
+            Policy::increment(_block->count);
+        }
+    }
+
+    void release() {
+        if (_block != nullptr && Policy::decrement(_block->count)) {
+            _block->dispose(_block);
+        }
+    }
+
+  public:
+    refc_ptr()
+        : _ptr(nullptr)
+        , _block(nullptr) {}
+
+    template <typename Y, typename = std::enable_if_t<std::is_convertible_v<Y *, T *>>>
     refc_ptr(Y *ptr)
         : _ptr(ptr)
-        , _count(ptr ? new std::atomic<int>(1) : nullptr) {}
+        , _block(nullptr) {
+        adopt(ptr);
+    }
+
+    refc_ptr(const refc_ptr &other)
+        : refc_ptr(other._ptr, other._block) {}
+
+    template <typename Y, typename = std::enable_if_t<std::is_convertible_v<Y *, T *>>>
+    refc_ptr(const refc_ptr<Y, Policy> &other)
+        : refc_ptr(other._ptr, other._block) {}
 
+    // aliasing: share `other`'s count but point at `ptr`
     template <typename Y>
-    refc_ptr(const refc_ptr<Y> &other, T *ptr) noexcept
-        : _ptr(ptr)
-        , _count(other._count) // get_shared_count())
-    {
-        if (_count != nullptr) {
-            _count->fetch_add(1);
-        }
-    }
+    refc_ptr(const refc_ptr<Y, Policy> &other, T *ptr) noexcept
+        : refc_ptr(ptr, other._block) {}
 
     refc_ptr(refc_ptr &&other) noexcept
         : _ptr(other._ptr)
-        , _count(other._count) {
+        , _block(other._block) {
         other._ptr = nullptr;
-        other._count = nullptr;
+        other._block = nullptr;
     }
 
-    ~refc_ptr() {
-        if (_count != nullptr && _count->fetch_sub(1) == 1) {
-            delete _ptr;
-            delete _count;
-        }
-    }
+    ~refc_ptr() { release(); }
 
-    void reset(T *ptr) {
-        if (_count != nullptr && _count->fetch_sub(1) == 1) {
-            delete _ptr;
-            delete _count;
-        }
+    void reset(T *ptr = nullptr) {
+        release();
         _ptr = ptr;
-        _count = ptr ? new std::atomic<int>(1) : nullptr;
+        _block = nullptr;
+        adopt(ptr);
     }
 
     refc_ptr &operator=(const refc_ptr &other) {
         if (this != &other) {
-            if (_count != nullptr && _count->fetch_sub(1) == 1) {
-                delete _ptr;
-                delete _count;
-            }
-
-            _ptr = other._ptr;
-            _count = other._count;
-            if (_count != nullptr) {
-                _count->fetch_add(1);
-            }
+            refc_ptr copy(other);
+            *this = std::move(copy);
         }
         return *this;
     }
 
     refc_ptr &operator=(refc_ptr &&other) noexcept {
         if (this != &other) {
-            if (_count != nullptr && _count->fetch_sub(1) == 1) {
-                delete _ptr;
-                delete _count;
-            }
+            release();
             _ptr = other._ptr;
-            _count = other._count;
+            _block = other._block;
             other._ptr = nullptr;
-            other._count = nullptr;
+            other._block = nullptr;
         }
         return *this;
     }
 
+    long use_count() const { return _block != nullptr ? static_cast<long>(_block->count) : 0; }
+
     T *get() const { return _ptr; }
     bool operator!() const { return !_ptr; }
+    explicit operator bool() const { return _ptr != nullptr; }
     T &operator*() const { return *_ptr; }
     T *operator->() const { return _ptr; }
 };
 
-template <typename T, typename... Args>
-refc_ptr<T> make_refc_ptr(Args &&...args) {
-    return refc_ptr<T>(new T(std::forward<Args>(args)...));
+// one allocation: intrusive objects carry their count, everything else gets
+// its control block allocated together with the object
+template <typename T, typename Policy, typename... Args>
+refc_ptr<T, Policy> make_refc_ptr(Args &&...args) {
+    if constexpr (detail::is_intrusive<T, Policy>) {
+        return refc_ptr<T, Policy>(new T(std::forward<Args>(args)...));
+    } else {
+        std::unique_ptr<detail::refc_inplace<T, Policy>> block(new detail::refc_inplace<T, Policy>());
+        auto *object = ::new (static_cast<void *>(block->storage)) T(std::forward<Args>(args)...);
+        return refc_ptr<T, Policy>(object, block.release());
+    }
 }
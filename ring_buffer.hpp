@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace rx {
+
+// fixed-capacity FIFO over one contiguous block. pushing into a full buffer
+// overwrites the oldest element, so steady-state use never allocates. the
+// contents are at most two contiguous runs, which `for_each` walks in order
+// and `for_each_run` hands out whole.
+template <typename T>
+class ring_buffer {
+    T *_data = nullptr;
+    size_t _capacity = 0;
+    size_t _head = 0; // oldest element
+    size_t _size = 0;
+
+    size_t wrap(size_t index) const { return index >= _capacity ? index - _capacity : index; }
+
+    void release() {
+        clear();
+        std::allocator<T>().deallocate(_data, _capacity);
+        _data = nullptr;
+        _capacity = 0;
+    }
+
+  public:
+    explicit ring_buffer(size_t capacity = 0)
+        : _data(capacity > 0 ? std::allocator<T>().allocate(capacity) : nullptr)
+        , _capacity(capacity) {}
+
+    ring_buffer(const ring_buffer &other)
+        : ring_buffer(other._capacity) {
+        other.for_each([this](const T &value) {
+            push_back(value);
+        });
+    }
+
+    ring_buffer(ring_buffer &&other) noexcept
+        : _data(std::exchange(other._data, nullptr))
+        , _capacity(std::exchange(other._capacity, 0))
+        , _head(std::exchange(other._head, 0))
+        , _size(std::exchange(other._size, 0)) {}
+
+    ring_buffer &operator=(ring_buffer other) noexcept {
+        std::swap(_data, other._data);
+        std::swap(_capacity, other._capacity);
+        std::swap(_head, other._head);
+        std::swap(_size, other._size);
+        return *this;
+    }
+
+    ~ring_buffer() { release(); }
+
+    size_t size() const { return _size; }
+    size_t capacity() const { return _capacity; }
+    bool empty() const { return _size == 0; }
+    bool full() const { return _size == _capacity; }
+
+    T &front() { return _data[_head]; }
+    const T &front() const { return _data[_head]; }
+    T &back() { return _data[wrap(_head + _size - 1)]; }
+    const T &back() const { return _data[wrap(_head + _size - 1)]; }
+
+    // `i`-th oldest
+    const T &operator[](size_t i) const { return _data[wrap(_head + i)]; }
+
+    template <typename U>
+    void push_back(U &&value) {
+        if (_capacity == 0) {
+            return;
+        }
+        if (full()) {
+            _data[_head] = std::forward<U>(value);
+            _head = wrap(_head + 1);
+            return;
+        }
+        ::new (static_cast<void *>(_data + wrap(_head + _size))) T(std::forward<U>(value));
+        _size++;
+    }
+
+    void pop_front() {
+        _data[_head].~T();
+        _head = wrap(_head + 1);
+        _size--;
+    }
+
+    void clear() {
+        while (!empty()) {
+            pop_front();
+        }
+        _head = 0;
+    }
+
+    // moves the contents into a larger block, oldest first
+    void reserve(size_t capacity) {
+        if (capacity <= _capacity) {
+            return;
+        }
+        ring_buffer larger(capacity);
+        while (!empty()) {
+            larger.push_back(std::move(front()));
+            pop_front();
+        }
+        *this = std::move(larger);
+    }
+
+    // the contiguous runs, oldest first, as `fun(data, count)`
+    template <typename F>
+    void for_each_run(F &&fun) const {
+        size_t first = std::min(_size, _capacity - _head);
+        if (first > 0) {
+            fun(static_cast<const T *>(_data + _head), first);
+        }
+        if (_size > first) {
+            fun(static_cast<const T *>(_data), _size - first);
+        }
+    }
+
+    // oldest to newest, one tight loop per contiguous run
+    template <typename F>
+    void for_each(F &&fun) const {
+        for_each_run([&fun](const T *data, size_t count) {
+            for (const T *it = data, *end = data + count; it != end; ++it) {
+                fun(*it);
+            }
+        });
+    }
+};
+
+} // namespace rx
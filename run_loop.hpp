@@ -0,0 +1,317 @@
+#pragma once
+
+#include "refc_ptr.hpp"
+#include "scheduler.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace rx {
+
+// one thread multiplexing file descriptors, timers and posted actions with
+// epoll. timers live in a heap and share a single timerfd armed for the
+// earliest deadline, posted actions wake the loop through an eventfd, so
+// thousands of sockets and timers cost no thread each. every callback runs
+// on the loop thread.
+class run_loop : public scheduler {
+  public:
+    using clock_t = std::chrono::steady_clock;
+    using timer_id = uint64_t;
+    // called with the ready events (EPOLLIN, ...)
+    using handler_t = std::function<void(uint32_t)>;
+    // returns the next deadline to re-arm at, or nullopt to stop
+    using recurring_t = std::function<std::optional<clock_t::time_point>()>;
+
+  private:
+    struct pending_t {
+        clock_t::time_point deadline;
+        timer_id id;
+
+        bool operator>(const pending_t &other) const {
+            return deadline != other.deadline ? deadline > other.deadline : id > other.id;
+        }
+    };
+
+    struct watch_t {
+        handler_t handler;
+        bool busy = false;
+    };
+
+    int _epoll;
+    int _wakeup;
+    int _timer;
+    std::mutex _mtx;
+    std::deque<action_t> _posted;
+    // cancelled timers are only dropped from the heap once they come due
+    std::priority_queue<pending_t, std::vector<pending_t>, std::greater<pending_t>> _heap;
+    std::unordered_map<timer_id, recurring_t> _timers;
+    std::unordered_map<int, refc_ptr<watch_t>> _watches;
+    clock_t::time_point _armed = clock_t::time_point::max();
+    timer_id _next_id = 1;
+    std::atomic<bool> _stop = false;
+    std::thread _thread;
+
+    void add_fd(int fd) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    // steady_clock is CLOCK_MONOTONIC, deadlines go to the timerfd as is
+    void arm(clock_t::time_point deadline) {
+        _armed = deadline;
+        itimerspec spec = {};
+        if (deadline != clock_t::time_point::max()) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+            ns = std::max<decltype(ns)>(ns, 1); // zero would disarm it
+            spec.it_value.tv_sec = ns / 1000000000;
+            spec.it_value.tv_nsec = ns % 1000000000;
+        }
+        timerfd_settime(_timer, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    bool run_posted() {
+        std::deque<action_t> posted;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            posted.swap(_posted);
+        }
+        for (auto &action : posted) {
+            action();
+        }
+        return !posted.empty();
+    }
+
+    bool run_timers() {
+        bool ran = false;
+        auto now = clock_t::now();
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (!_heap.empty() && _heap.top().deadline <= now) {
+            auto id = _heap.top().id;
+            _heap.pop();
+            auto it = _timers.find(id);
+            if (it == _timers.end()) {
+                continue;
+            }
+            // the entry stays while it runs, so a cancel from inside is seen
+            auto fun = std::move(it->second);
+            lock.unlock();
+            auto next = fun();
+            ran = true;
+            lock.lock();
+            it = _timers.find(id);
+            if (it == _timers.end()) {
+                continue;
+            }
+            if (next) {
+                it->second = std::move(fun);
+                _heap.push({*next, id});
+            } else {
+                _timers.erase(it);
+            }
+        }
+        arm(_heap.empty() ? clock_t::time_point::max() : _heap.top().deadline);
+        return ran;
+    }
+
+    bool run_watch(int fd, uint32_t events) {
+        refc_ptr<watch_t> watch;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto it = _watches.find(fd);
+            if (it == _watches.end()) {
+                return false;
+            }
+            watch = it->second;
+        }
+        // a handler that waits in `run_one` isn't re-entered, its
+        // descriptor is reported again once it returns
+        if (watch->busy) {
+            return false;
+        }
+        watch->busy = true;
+        watch->handler(events);
+        watch->busy = false;
+        return true;
+    }
+
+    // waits up to `timeout_ms` (-1: forever) and dispatches what is ready
+    bool poll(int timeout_ms) {
+        epoll_event events[64];
+        int ready = epoll_wait(_epoll, events, 64, timeout_ms);
+        bool ran = false;
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == _wakeup) {
+                eventfd_t count;
+                eventfd_read(_wakeup, &count);
+                ran |= run_posted();
+            } else if (fd == _timer) {
+                uint64_t expirations;
+                ssize_t len = read(_timer, &expirations, sizeof(expirations));
+                (void)len;
+                ran |= run_timers();
+            } else {
+                ran |= run_watch(fd, events[i].events);
+            }
+        }
+        return ran;
+    }
+
+    void run() {
+        scheduler::current() = this;
+        trace::name_thread("run_loop");
+        while (!_stop.load()) {
+            poll(-1);
+        }
+        scheduler::current() = nullptr;
+    }
+
+  public:
+    run_loop()
+        : _epoll(epoll_create1(EPOLL_CLOEXEC))
+        , _wakeup(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        , _timer(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) {
+        if (_epoll < 0 || _wakeup < 0 || _timer < 0) {
+            perror("run_loop");
+        }
+        add_fd(_wakeup);
+        add_fd(_timer);
+        _thread = std::thread([this] {
+            run();
+        });
+    }
+
+    run_loop(const run_loop &) = delete;
+    run_loop &operator=(const run_loop &) = delete;
+
+    ~run_loop() override {
+        _stop = true;
+        eventfd_write(_wakeup, 1);
+        _thread.join();
+        close(_timer);
+        close(_wakeup);
+        close(_epoll);
+    }
+
+    static const refc_ptr<run_loop> &shared() {
+        static refc_ptr<run_loop> loop(new run_loop());
+        return loop;
+    }
+
+    static run_loop &instance() { return *shared(); }
+
+    // runs `action` on the loop thread, callable from any thread
+    void schedule(action_t action) override {
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            wake = _posted.empty();
+            _posted.push_back(trace::traced(std::move(action), "hop", "run_loop"));
+        }
+        // the loop takes the whole queue at once, one wakeup covers it
+        if (wake) {
+            eventfd_write(_wakeup, 1);
+        }
+    }
+
+    timer_id schedule_recurring(clock_t::time_point when, recurring_t fun) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto id = _next_id++;
+        _timers.emplace(id, trace::traced(std::move(fun), "timer", "run_loop"));
+        _heap.push({when, id});
+        if (when < _armed) {
+            arm(when);
+        }
+        return id;
+    }
+
+    timer_id schedule_at(clock_t::time_point when, action_t action) {
+        return schedule_recurring(when, [action = std::move(action)]() -> std::optional<clock_t::time_point> {
+            action();
+            return std::nullopt;
+        });
+    }
+
+    template <typename Duration>
+    timer_id schedule_after(const Duration &delay, action_t action) {
+        return schedule_at(clock_t::now() + std::chrono::duration_cast<clock_t::duration>(delay), std::move(action));
+    }
+
+    // a timer that hasn't started yet never will, one that is running is
+    // not re-armed
+    void cancel(timer_id id) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _timers.erase(id);
+    }
+
+    // calls `handler` on the loop thread for as long as `fd` is ready for
+    // `events` (level triggered). one handler per descriptor.
+    void watch(int fd, uint32_t events, handler_t handler) {
+        auto entry = make_refc_ptr<watch_t>();
+        entry->handler = trace::traced(std::move(handler), "io", "run_loop");
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _watches[fd] = entry;
+        }
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    // changes what `fd` is watched for, 0 pauses it
+    void modify(int fd, uint32_t events) {
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    // stops watching `fd`. a handler already running on the loop thread
+    // finishes, so whatever it uses has to stay valid until then.
+    void unwatch(int fd) {
+        epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        std::lock_guard<std::mutex> lock(_mtx);
+        _watches.erase(fd);
+    }
+
+    // dispatch whatever is ready without blocking, for a loop-thread
+    // callback that waits on a nested subscription
+    bool run_one() override { return scheduler::current() == this && poll(0); }
+
+    // the loop sleeps in epoll, where waking `me` reaches it through the
+    // eventfd. whatever is ready meanwhile runs.
+    void park(detail::parker &me) override {
+        me.interrupt(this);
+        if (!me.woken()) {
+            poll(-1);
+        }
+        me.interrupt(nullptr);
+    }
+
+    void interrupt() override { eventfd_write(_wakeup, 1); }
+};
+
+namespace schedulers {
+
+inline scheduler_ptr run_loop() { return rx::run_loop::shared(); }
+
+} // namespace schedulers
+
+} // namespace rx
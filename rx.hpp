@@ -1,9 +1,29 @@
 #pragma once
 
+#include "bloom_filter.hpp"
+#include "flat_hash.hpp"
+#include "inplace_function.hpp"
+#include "metrics.hpp"
 #include "refc_ptr.hpp"
+#include "run_loop.hpp"
+#include "scheduler.hpp"
+#include "simd.hpp"
+#include "slab.hpp"
+#include "span.hpp"
+#include "subscription.hpp"
+#include "timer_wheel.hpp"
+#include "vector_pool.hpp"
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <deque>
+#include <fcntl.h>
 #include <functional>
 #include <future>
 #include <initializer_list>
@@ -12,12 +32,16 @@
 #include <iterator>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <queue>
 #include <stack>
+#include <string>
 #include <thread>
+#include <tuple>
 #include <typeinfo>
-#include <unordered_set>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 
 #define DEBUG_METHOD() std::cout << timestamp() << " " << __PRETTY_FUNCTION__ << " @ " << this << std::endl
@@ -31,12 +55,28 @@ std::ostream &operator<<(std::ostream &os, const std::pair<T, U> &v) {
     return os;
 }
 
+template <typename... Ts>
+std::ostream &operator<<(std::ostream &os, const std::tuple<Ts...> &v) {
+    std::apply(
+        [&os](const auto &first, const auto &...rest) {
+            os << first;
+            ((os << "," << rest), ...);
+        },
+        v);
+    return os;
+}
+
 template <typename T>
 std::ostream &operator<<(std::ostream &os, const std::vector<T> &v) {
     std::copy(v.begin(), v.end(), std::ostream_iterator<T>(os, ","));
     return os;
 }
 
+template <typename T>
+std::ostream &operator<<(std::ostream &os, const rx::pooled_vector<T> &v) {
+    return os << v.values();
+}
+
 template <typename Rep, typename Period>
 std::ostream &operator<<(std::ostream &os, const std::chrono::duration<Rep, Period> &duration) {
     os << duration.count();
@@ -60,41 +100,408 @@ auto from(Iterable iterable);
 template <typename... Ts>
 auto of(Ts &&...ts);
 
+// legacy early exit, still honoured when thrown from a subscribe callback.
+// sources and operators stop through `subscription` instead.
 struct on_complete : public std::exception {};
 
+// longest run a bulk source hands out in one `on_next_batch` call
+#ifndef RX_BATCH_SIZE
+#define RX_BATCH_SIZE 1024
+#endif
+
+// the per-element callback, plus an optional one for contiguous runs. bulk
+// sources call `on_next_batch`, which falls back to one call per element for
+// observers that were given no batch callback. batch callbacks are opt-in
+// (the two-callable constructor), a generic lambda stays per element.
+template <typename T>
+class observer {
+  public:
+    using next_t = inplace_function<void(const T &)>;
+    using batch_t = inplace_function<void(span<const T>)>;
+
+  private:
+    next_t _next;
+    batch_t _batch;
+
+  public:
+    observer() = default;
+    observer(std::nullptr_t) {}
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, observer> &&
+                                                      std::is_invocable_v<std::decay_t<F> &, const T &>>>
+    observer(F &&next)
+        : _next(std::forward<F>(next)) {}
+
+    template <typename F, typename B>
+    observer(F &&next, B &&batch)
+        : _next(std::forward<F>(next))
+        , _batch(std::forward<B>(batch)) {}
+
+    void operator()(const T &value) const { _next(value); }
+
+    void on_next_batch(span<const T> values) const {
+        if (_batch) {
+            _batch(values);
+            return;
+        }
+        for (const auto &value : values) {
+            _next(value);
+        }
+    }
+
+    bool has_batch() const { return static_cast<bool>(_batch); }
+    explicit operator bool() const { return static_cast<bool>(_next); }
+};
+
+namespace detail {
+
+// hands `count` elements at `data` out in runs, as far as the demand allows. an
+// observer without a batch callback gets them one by one, as any source would.
+template <typename T>
+void emit_batches(const observer<T> &next, const subscription &sub, const T *data, size_t count) {
+    if (!next.has_batch()) {
+        for (size_t i = 0; i < count && sub.acquire(); i++) {
+            next(data[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < count;) {
+        size_t n = sub.acquire(std::min<size_t>(count - i, RX_BATCH_SIZE));
+        if (n == 0) {
+            break;
+        }
+        next.on_next_batch(span<const T>(data + i, n));
+        i += n;
+    }
+}
+
+#ifdef RX_METRICS
+// `obs`, counting and timing the elements `from` hands it while `to` runs
+template <typename T>
+observer<T> instrumented(observer<T> &&obs, metrics::stage *from, metrics::stage *to) {
+    auto target = make_refc_ptr<observer<T>>(std::move(obs));
+    auto next = [target, from, to](const T &value) {
+        metrics::delivery timed(from, to, 1);
+        (*target)(value);
+    };
+    if (!target->has_batch()) {
+        return observer<T>(next);
+    }
+    return observer<T>(next, [target, from, to](span<const T> values) {
+        metrics::delivery timed(from, to, values.size());
+        target->on_next_batch(values);
+    });
+}
+#endif
+
+template <typename C, typename = void>
+struct is_contiguous : std::false_type {};
+
+template <typename C>
+struct is_contiguous<C, std::void_t<decltype(std::data(std::declval<const C &>()))>> : std::true_type {};
+
+// folds that reduce can hand to `simd::sum`
+template <typename F, typename T>
+struct is_plus : std::bool_constant<std::is_arithmetic_v<T> &&
+                                    (std::is_same_v<F, std::plus<T>> || std::is_same_v<F, std::plus<>>)> {};
+
+// what the `distinct` operators remember. `insert` is true for a new value.
+template <typename T>
+struct seen_all {
+    flat_hash_set<T> values;
+
+    bool insert(const T &value) { return values.insert(value); }
+};
+
 template <typename T>
-using observer = std::function<void(const T &)>;
+struct seen_window {
+    size_t window;
+    flat_hash_set<T> values;
+    std::deque<T> order;
+
+    explicit seen_window(size_t window)
+        : window(window)
+        , values(window) {}
+
+    bool insert(const T &value) {
+        if (!values.insert(value)) {
+            return false;
+        }
+        order.push_back(value);
+        if (order.size() > window) {
+            values.erase(order.front());
+            order.pop_front();
+        }
+        return true;
+    }
+};
+
+// once `current` holds `window` values it becomes `previous`, so what is
+// remembered is between one and two windows' worth
+template <typename T>
+struct seen_bloom {
+    size_t window;
+    size_t added = 0;
+    bloom_filter<T> current;
+    bloom_filter<T> previous;
+
+    // two filters are asked, each gets half the rate
+    seen_bloom(size_t window, double fp_rate)
+        : window(std::max<size_t>(window, 1))
+        , current(window, fp_rate / 2)
+        , previous(window, fp_rate / 2) {}
+
+    bool insert(const T &value) {
+        if (current.contains(value) || previous.contains(value)) {
+            return false;
+        }
+        if (added == window) {
+            std::swap(current, previous);
+            current.clear();
+            added = 0;
+        }
+        current.insert(value);
+        added++;
+        return true;
+    }
+};
+
+} // namespace detail
+
+// observables count their references intrusively, and atomically: timers,
+// flat_map and the schedulers hand them to other threads behind the chain's
+// back, so a thread-local count is only for refc_ptrs of one's own.
+using refc_policy = refc_atomic;
 
 template <typename T>
 class observable;
 
+template <typename K, typename T>
+class grouped_observable;
+
 template <typename T>
-using shared_observable = refc_ptr<observable<T>>;
+using shared_observable = refc_ptr<observable<T>, refc_policy>;
 
+// operators hold a reference to the observable they were created from, so a
+// chain built from temporaries (`rx::of(1)->delay(10ms)`) keeps its upstream
+// alive for as long as the result is referenced
 template <typename T>
-class observable {
+class observable : public enable_refc_from_this<observable<T>, refc_policy> {
   public:
     using observer_t = observer<T>;
-    using completer_t = std::function<void()>;
-    using subscribe_callback = std::function<void(const observer_t &)>;
+    using completer_t = inplace_function<void()>;
+    using subscribe_callback = inplace_function<void(observer_t &&, const subscription &)>;
     int _;
 
   private:
     subscribe_callback _subscribe_callback;
-    std::vector<completer_t> _completers;
+    bool _hot = false;
+#ifdef RX_METRICS
+    std::string _name;
+    metrics::stage *_stage = nullptr;
+#endif
 
-    void subscribe_impl(const observer_t &obj) {
-        try {
-            _subscribe_callback(obj);
-        } catch (const on_complete &oc) {
-            return;
+    static subscription subscription_of() { return subscription(); }
+
+    template <typename U, typename... Us>
+    static subscription subscription_of(const U &first, const Us &...rest) {
+        if constexpr (std::is_same_v<U, subscription>) {
+            return first;
+        } else if constexpr (sizeof...(Us) > 0) {
+            return subscription_of(rest...);
+        } else {
+            return subscription();
+        }
+    }
+
+    template <typename U>
+    static constexpr bool is_subscription = std::is_same_v<std::decay_t<U>, subscription>;
+
+    // the one `subscription_of` would copy, for callers that hold on to it
+    template <typename U, typename... Us>
+    static const subscription &subscription_in(const U &first, const Us &...rest) {
+        if constexpr (std::is_same_v<U, subscription>) {
+            return first;
+        } else {
+            return subscription_in(rest...);
+        }
+    }
+
+    template <typename F>
+    void subscribe_impl(F &&fun, const subscription &sub) {
+        if constexpr (std::is_invocable_v<F &, const T &>) {
+#ifdef RX_METRICS
+            metrics::subscribe_scope scope(_stage);
+            auto obs = detail::instrumented(observer_t(std::forward<F>(fun)), _stage, scope.subscriber());
+#else
+            observer_t obs(std::forward<F>(fun));
+#endif
+#ifdef __cpp_exceptions
+            try {
+                _subscribe_callback(std::move(obs), sub);
+            } catch (const on_complete &) {
+            }
+#else
+            _subscribe_callback(std::move(obs), sub);
+#endif
         }
     }
-    void subscribe_impl(const completer_t &obj) { _completers.push_back(obj); }
+
+    // state an operator's callbacks share. a hot upstream keeps calling them
+    // after the subscribe call that made them, so then they own it. a cold
+    // one is done once that call returns, and `local` on its stack will do.
+    template <typename S>
+    refc_ptr<S> callback_state(std::optional<S> &local, S &&initial) const {
+        if (_hot) {
+            return make_refc_ptr<S>(std::forward<S>(initial));
+        }
+        local.emplace(std::forward<S>(initial));
+        return refc_ptr<S>(refc_ptr<S>(), &*local);
+    }
+
+    template <typename F>
+    void complete_impl(F &fun) {
+        if constexpr (std::is_invocable_v<F &>) {
+            if (_hot) {
+                completed(completer_t(fun));
+            } else {
+                fun();
+            }
+        }
+    }
+
+    // min, or max if `Max`
+    template <bool Max>
+    auto extreme(const char *name = __builtin_FUNCTION()) {
+        return make_observable<T>(
+            [this, self = this->refc_from_this()](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    observer_t obs;
+                    std::optional<T> result;
+
+                    void offer(const T &value) {
+                        if (!result || (Max ? *result < value : value < *result)) {
+                            result = value;
+                        }
+                    }
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(obs), {}});
+                this->subscribe(
+                    sub.unbounded_child(),
+                    observer_t(
+                        [state](const T &value) {
+                            state->offer(value);
+                        },
+                        [state](span<const T> values) {
+                            if (!values.empty()) {
+                                state->offer(Max ? simd::max(values) : simd::min(values));
+                            }
+                        }),
+                    [state] {
+                        if (state->result) {
+                            state->obs(*state->result);
+                        }
+                    });
+            },
+            name);
+    }
+
+    // lets through the values `seen.insert` reports as new
+    template <typename Seen>
+    auto drop_seen(Seen seen, const char *name = __builtin_FUNCTION()) {
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), seen](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    observer_t obs;
+                    Seen seen;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(obs), seen});
+                this->subscribe(sub, [state, sub](const T &value) {
+                    if (state->seen.insert(value)) {
+                        state->obs(value);
+                    } else {
+                        sub.request(1);
+                    }
+                });
+            },
+            name);
+    }
+
+    // the time windows of `window_with_time`, each handed out as `make(view)`
+    template <typename U, typename Duration, typename Shift, typename Make>
+    auto windows_by_time(const Duration &a_length, const Shift &a_shift, Make make,
+                         const char *name = __builtin_FUNCTION()) {
+        using clock_t = timer_wheel::clock_t;
+        auto length = std::chrono::duration_cast<clock_t::duration>(a_length);
+        auto shift = std::chrono::duration_cast<clock_t::duration>(a_shift);
+
+        return make_observable<U>(
+            [this, self = this->refc_from_this(), length, shift, make](observer<U> &&on_next, const subscription &sub) {
+                struct state_t {
+                    std::recursive_mutex mtx;
+                    detail::slab_buffer<T> buffer{RX_BATCH_SIZE};
+                    // when each element in the current slab arrived
+                    std::deque<clock_t::time_point> stamps;
+                    clock_t::time_point next_close;
+                    bool stopped = false;
+                    observer<U> on_next;
+                };
+                auto state = make_refc_ptr<state_t>();
+                state->on_next = std::move(on_next);
+
+                // the window that closes at `close`
+                auto emit = [state, length, make](clock_t::time_point close) {
+                    auto &stamps = state->stamps;
+                    auto first = std::lower_bound(stamps.begin(), stamps.end(), close - length) - stamps.begin();
+                    auto last = std::lower_bound(stamps.begin(), stamps.end(), close) - stamps.begin();
+                    if (first < last) {
+                        state->on_next(make(state->buffer.view(static_cast<size_t>(first), static_cast<size_t>(last))));
+                    }
+                };
+
+                state->next_close = clock_t::now() + shift;
+                timer_wheel::instance().schedule_recurring(
+                    state->next_close, [state, emit, shift]() -> std::optional<clock_t::time_point> {
+                        std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                        if (state->stopped) {
+                            return std::nullopt;
+                        }
+                        emit(state->next_close);
+                        return state->next_close += shift;
+                    });
+
+                this->subscribe(sub.unbounded_child(), [state, length, shift](const T &value) {
+                    std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                    auto &stamps = state->stamps;
+                    auto now = clock_t::now();
+                    // a late tick may still close a window that began this far back
+                    auto needed = std::lower_bound(stamps.begin(), stamps.end(), now - length - shift);
+                    size_t dropped = state->buffer.push(value, static_cast<size_t>(stamps.end() - needed));
+                    stamps.erase(stamps.begin(), stamps.begin() + static_cast<long>(dropped));
+                    stamps.push_back(now);
+                });
+
+                // whatever arrived after a late last tick goes out too
+                std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                state->stopped = true;
+                emit(std::max(state->next_close, clock_t::now() + clock_t::duration(1)));
+            },
+            name);
+    }
 
   public:
     observable(subscribe_callback fun)
-        : _subscribe_callback(fun) {}
+        : _subscribe_callback(std::move(fun)) {}
+
+    // callbacks that don't care about cancellation can leave out the subscription
+    template <typename F, typename = std::enable_if_t<std::is_invocable_v<F &, observer_t &&> &&
+                                                      !std::is_invocable_v<F &, observer_t &&, const subscription &>>>
+    observable(F fun)
+        : _subscribe_callback([fun = std::move(fun)](observer_t &&obs, const subscription &) {
+            fun(std::move(obs));
+        }) {}
 
     observable(const observable &other) = delete;
 //    : _subscribe_callback(other._subscribe_callback)
@@ -106,483 +513,1939 @@ class observable {
         // DEBUG_METHOD();
     }
 
+    // subscribes every observer in `ts`, then runs every completer. pass a
+    // `subscription` to join an existing one, otherwise a new one is created.
+    // either way it is returned, and disposing it stops the sources early.
+    // one the caller holds is returned by reference: a copy would make its
+    // state, which operators passing theirs on don't need.
     template <typename... Ts>
-    void subscribe(Ts &&...ts) {
-        (subscribe_impl(std::forward<Ts>(ts)), ...);
-
-        for (const auto &complete : _completers) {
-            complete();
+    decltype(auto) subscribe(Ts &&...ts) {
+        constexpr bool held = (is_subscription<Ts> || ...) &&
+                              ((!is_subscription<Ts> || std::is_lvalue_reference_v<Ts>) && ...);
+        if constexpr (held) {
+            const subscription &sub = subscription_in(ts...);
+            (subscribe_impl(std::forward<Ts>(ts), sub), ...);
+            (complete_impl(ts), ...);
+            return sub;
+        } else {
+            subscription sub = subscription_of(ts...);
+            (subscribe_impl(std::forward<Ts>(ts), sub), ...);
+            (complete_impl(ts), ...);
+            return sub;
         }
     }
 
+    // the name this stage's counters are kept under with RX_METRICS, see
+    // metrics.hpp. operators made from it afterwards are named after it.
+    auto named(const std::string &name) {
+        set_name(name);
+        return this->refc_from_this();
+    }
+
+    // the same for observables that aren't owned by a refc_ptr (subjects)
+    void set_name(const std::string &name) {
+#ifdef RX_METRICS
+        _name = name;
+        _stage = metrics::registry::instance().get(name);
+#else
+        (void)name;
+#endif
+    }
+
+    // whether subscribers may be called after their subscribe call returned:
+    // subjects, groups, and what is made from sources it can't see into.
+    // operators made from it afterwards inherit it.
+    bool is_hot() const { return _hot; }
+
+    void set_hot(bool hot) { _hot = hot; }
+
+  protected:
+    // a completer given to `subscribe` on a hot observable, whose subscribe
+    // call returns before the sequence ends. one that knows when it ends
+    // runs it then.
+    virtual void completed(completer_t &&done) { done(); }
+
+  public:
+
     template <typename Pred>
     auto filter(Pred &&pred) {
-        return make_observable<T>([this, pred](const observer_t &obs) {
-            this->subscribe([pred, obs](const T &t) {
-                if (pred(t)) {
-                    obs(t);
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), pred](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    observer_t obs;
+                    std::vector<T> kept;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(obs), {}});
+
+                auto next = [pred, state, sub](const T &t) {
+                    if (pred(t)) {
+                        state->obs(t);
+                    } else {
+                        // the element was paid for but never delivered
+                        sub.request(1);
+                    }
+                };
+                // batches only if the downstream takes them, a per-element
+                // downstream may stop halfway through
+                if (!state->obs.has_batch()) {
+                    this->subscribe(sub, next);
+                    return;
                 }
+                observer_t filtered(
+                    next,
+                    [pred, state, sub](span<const T> values) {
+                        auto &kept = state->kept;
+                        kept.clear();
+                        for (const auto &value : values) {
+                            if (pred(value)) {
+                                kept.push_back(value);
+                            }
+                        }
+                        if (!kept.empty()) {
+                            state->obs.on_next_batch(kept);
+                        }
+                        sub.request(static_cast<long>(values.size() - kept.size()));
+                    });
+                this->subscribe(sub, std::move(filtered));
             });
-        });
     }
 
     template <typename Period>
     auto delay(const Period &a_while) {
-
-        return make_observable<T>([=](const observer_t &obs) {
-            std::this_thread::sleep_for(a_while);
-            this->subscribe([=](const T &t) {
-                obs(t);
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), a_while](observer_t &&obs, const subscription &sub) {
+                // one timer entry per element, delivered on the timer thread. the
+                // subscription completes once the last delayed element is out,
+                // elements still in flight when it is disposed are dropped.
+                struct state_t {
+                    observer_t obs;
+                    subscription sub;
+                    completion pending;
+                };
+                auto state = make_refc_ptr<state_t>();
+                state->obs = std::move(obs);
+                state->sub = sub;
+                this->subscribe(sub, [state, a_while](const T &value) {
+                    state->pending.add();
+                    timer_wheel::instance().schedule_after(a_while, [state, value] {
+                        if (!state->sub.is_disposed()) {
+                            state->obs(value);
+                        }
+                        state->pending.done();
+                    });
+                });
+                // a hot upstream isn't done yet, its timer entries hold the state
+                if (!this->is_hot()) {
+                    state->pending.wait();
+                }
             });
-        });
     }
 
     template <typename Period>
     auto debounce(const Period &timeout) {
-        using clock_t = std::chrono::steady_clock;
-        return make_observable<T>([this, timeout](const observer_t &obs) {
-            auto last_time = clock_t::now();
-            bool is_first = true;
-            this->subscribe([=, &last_time, &is_first](const T &value) {
-                // when a new value comes in, check if the previous value
-                // arrived before the `timeout` if it didn't -> emit new
-                // value
-                auto current_time = clock_t::now();
-                if (current_time - last_time < timeout) {
-                    obs(value);
+        using clock_t = timer_wheel::clock_t;
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), timeout](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    std::recursive_mutex mtx;
+                    std::optional<T> latest;
+                    clock_t::time_point deadline;
+                    bool armed = false;
+                    bool stopped = false;
+                    observer_t obs;
+                };
+                auto state = make_refc_ptr<state_t>();
+                state->obs = std::move(obs);
+
+                this->subscribe(sub.unbounded_child(), [state, timeout](const T &value) {
+                    std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                    state->latest = value;
+                    state->deadline = clock_t::now() + timeout;
+                    if (state->armed) {
+                        return;
+                    }
+                    // a single timer per subscription: it re-arms itself while
+                    // newer values keep pushing the deadline out, and emits once
+                    // the stream has been quiet for `timeout`
+                    state->armed = true;
+                    timer_wheel::instance().schedule_recurring(
+                        state->deadline, [state]() -> std::optional<clock_t::time_point> {
+                            std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                            if (state->stopped) {
+                                return std::nullopt;
+                            }
+                            if (clock_t::now() < state->deadline) {
+                                return state->deadline;
+                            }
+                            state->armed = false;
+                            if (state->latest) {
+                                state->obs(*state->latest);
+                                state->latest.reset();
+                            }
+                            return std::nullopt;
+                        });
+                });
+
+                // on completion the pending value goes out right away
+                std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                if (state->latest) {
+                    state->obs(*state->latest);
+                    state->latest.reset();
                 }
-                last_time = current_time;
+                state->stopped = true;
             });
-        });
     }
 
     template <typename F>
     auto map(F &&fun) {
-        return make_observable<T>([this, fun](const observer_t &obs) {
-            this->subscribe([=](const T &t) {
-                obs(fun(t));
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), fun](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    observer_t obs;
+                    std::vector<T> mapped;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(obs), {}});
+
+                auto next = [fun, state](const T &t) {
+                    state->obs(fun(t));
+                };
+                if (!state->obs.has_batch()) {
+                    this->subscribe(sub, next);
+                    return;
+                }
+                observer_t mapper(
+                    next,
+                    [fun, state](span<const T> values) {
+                        auto &mapped = state->mapped;
+                        mapped.clear();
+                        for (const auto &value : values) {
+                            mapped.push_back(fun(value));
+                        }
+                        state->obs.on_next_batch(mapped);
+                    });
+                this->subscribe(sub, std::move(mapper));
             });
-        });
     }
 
     template <typename U>
     auto scan(U s, std::function<U(U, const T &)> accumulator) {
-        return make_observable<U>([this, s, accumulator](std::function<void(const U &)> on_next) {
-            U seed = s;
-            this->subscribe(
-                [&seed, accumulator, on_next](const T &value) {
-                    seed = accumulator(seed, value);
-                    on_next(seed);
-                },
-                [seed, on_next]() {
-                    on_next(seed);
-                });
-        });
+        return make_observable<U>(
+            [this, self = this->refc_from_this(), s, accumulator](observer<U> &&on_next, const subscription &sub) {
+                struct state_t {
+                    observer<U> on_next;
+                    U seed;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(on_next), s});
+                this->subscribe(
+                    sub,
+                    [state, accumulator](const T &value) {
+                        state->seed = accumulator(state->seed, value);
+                        state->on_next(state->seed);
+                    },
+                    [state, s]() {
+                        state->on_next(s);
+                    });
+            });
     }
 
     template <typename Duration>
     auto time_interval() {
-        return make_observable<Duration>([this](std::function<void(const Duration &)> on_next) {
-            using clock_t = std::chrono::steady_clock;
-            auto lastTime = clock_t::now();
-            this->subscribe([on_next, &lastTime](const T &value) {
-                auto currentTime = clock_t::now();
-                on_next(std::chrono::duration_cast<Duration>(currentTime - lastTime));
-                lastTime = currentTime;
+        return make_observable<Duration>(
+            [this, self = this->refc_from_this()](observer<Duration> &&on_next, const subscription &sub) {
+                using clock_t = std::chrono::steady_clock;
+                struct state_t {
+                    observer<Duration> on_next;
+                    clock_t::time_point last;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(on_next), clock_t::now()});
+                this->subscribe(sub, [state](const T &) {
+                    auto now = clock_t::now();
+                    state->on_next(std::chrono::duration_cast<Duration>(now - state->last));
+                    state->last = now;
+                });
             });
-        });
     }
 
     template <typename F>
     auto reduce(F &&fun, T seed = T{0}) {
-        return make_observable<T>([this, fun, seed](const observer_t &obs) {
-            T result = seed;
-            this->subscribe(
-                // next
-                [=, &result](const T &t) {
-                    result = fun(result, t);
-                },
-                // completed
-                [&] {
-                    obs(result);
-                });
-        });
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), fun, seed](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    observer_t obs;
+                    T result;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(obs), seed});
+                this->subscribe(
+                    sub.unbounded_child(),
+                    // next
+                    observer_t(
+                        [state, fun](const T &t) {
+                            state->result = fun(state->result, t);
+                        },
+                        [state, fun](span<const T> values) {
+                            if constexpr (detail::is_plus<std::decay_t<F>, T>::value) {
+                                state->result = static_cast<T>(state->result + simd::sum(values));
+                                return;
+                            }
+                            for (const auto &t : values) {
+                                state->result = fun(state->result, t);
+                            }
+                        }),
+                    // completed
+                    [state] {
+                        state->obs(state->result);
+                    });
+            });
     }
 
-    auto distinct() {
-        return make_observable<T>([this](const observer_t &next) {
-            std::unordered_set<T> seen = {};
-            this->subscribe([&](const T &value) {
-                if (seen.insert(value).second) {
-                    next(value);
-                }
+    // sum, smallest and largest element. runs that arrive as batches go
+    // through the kernels in simd.hpp. min and max emit nothing for an
+    // empty sequence.
+    auto sum() { return reduce(std::plus<T>()); }
+    auto min() { return extreme<false>(); }
+    auto max() { return extreme<true>(); }
+
+    // drops every value seen before, remembering all of them
+    auto distinct() { return drop_seen(detail::seen_all<T>()); }
+
+    // the same, remembering only the last `window` distinct values. one that
+    // comes back after that many others goes through again.
+    auto distinct(size_t window) { return drop_seen(detail::seen_window<T>(window)); }
+
+    // the same in fixed memory: about the last `window` distinct values are
+    // kept in two bloom filters taking turns. a repeat within the window is
+    // always dropped, a new value wrongly so with a chance of about `fp_rate`.
+    auto distinct_approx(size_t window, double fp_rate = 0.01) {
+        return drop_seen(detail::seen_bloom<T>(window, fp_rate));
+    }
+
+    // drops values equal to the one just before them
+    auto distinct_until_changed() {
+        return make_observable<T>(
+            [this, self = this->refc_from_this()](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    observer_t obs;
+                    std::optional<T> last;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(obs), {}});
+                this->subscribe(sub, [state, sub](const T &value) {
+                    if (state->last && *state->last == value) {
+                        sub.request(1);
+                        return;
+                    }
+                    state->last = value;
+                    state->obs(value);
+                });
             });
-        });
     }
 
     auto last() {
-        return make_observable<T>([this](const observer_t &next) {
-            T last;
-            this->subscribe(
-                [next, &last](const T &value) {
-                    last = value;
-                },
-                [next, &last] {
-                    next(last);
-                });
-        });
+        return make_observable<T>(
+            [this, self = this->refc_from_this()](observer_t &&next, const subscription &sub) {
+                struct state_t {
+                    observer_t next;
+                    T last;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(next), {}});
+                this->subscribe(
+                    sub.unbounded_child(),
+                    [state](const T &value) {
+                        state->last = value;
+                    },
+                    [state] {
+                        state->next(state->last);
+                    });
+            });
     }
 
     auto skip(size_t n) {
-        return make_observable<T>([this, n](const observer_t &next) {
-            size_t count = 0;
-            this->subscribe([&count, next, n](const T &value) {
-                if (count++ >= n) {
-                    next(value);
-                }
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), n](observer_t &&next, const subscription &sub) {
+                struct state_t {
+                    observer_t next;
+                    size_t count;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(next), 0});
+                this->subscribe(sub, [state, sub, n](const T &value) {
+                    if (state->count++ >= n) {
+                        state->next(value);
+                    } else {
+                        sub.request(1);
+                    }
+                });
             });
-        });
     }
     auto take(size_t n) {
-        return make_observable<T>([this, n](const observer_t &obs) {
-            size_t count = 0;
-            bool has_completed = false;
-            this->subscribe([this, &count, obs, n, &has_completed](const T &value) {
-                obs(value);
-                if (++count >= n) {
-                    has_completed = true;
-                    throw on_complete();
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), n](observer_t &&obs, const subscription &sub) {
+                if (n == 0) {
+                    return;
                 }
+                // stop the upstream once `n` values are through. a source that
+                // doesn't poll its subscription may still push a few, drop those.
+                struct state_t {
+                    observer_t obs;
+                    subscription upstream;
+                    size_t count;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(obs), sub.child(), 0});
+                this->subscribe(state->upstream, [state, n](const T &value) {
+                    if (state->count >= n) {
+                        return;
+                    }
+                    state->obs(value);
+                    if (++state->count >= n) {
+                        state->upstream.dispose();
+                    }
+                });
             });
-        });
     }
     auto average() {
-        return make_observable<T>([this](const observer_t &obs) {
-            float sum = 0.0f;
-            size_t n = 0;
-            this->subscribe([this, obs, &sum, &n](const T &value) {
-                sum += static_cast<decltype(sum)>(value);
-                obs(sum / ++n);
+        return make_observable<T>(
+            [this, self = this->refc_from_this()](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    observer_t obs;
+                    // a wide accumulator, a float loses integers past 2^24
+                    simd::sum_t<T> sum;
+                    size_t n;
+                    std::vector<T> averages;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(obs), 0, 0, {}});
+                auto next = [state](const T &value) {
+                    state->sum += static_cast<decltype(state->sum)>(value);
+                    state->obs(static_cast<T>(state->sum / static_cast<decltype(state->sum)>(++state->n)));
+                };
+                if (!state->obs.has_batch()) {
+                    this->subscribe(sub, next);
+                    return;
+                }
+                this->subscribe(
+                    sub,
+                    observer_t(
+                        next,
+                        [state](span<const T> values) {
+                            auto &averages = state->averages;
+                            averages.clear();
+                            for (const auto &value : values) {
+                                state->sum += static_cast<decltype(state->sum)>(value);
+                                averages.push_back(
+                                    static_cast<T>(state->sum / static_cast<decltype(state->sum)>(++state->n)));
+                            }
+                            state->obs.on_next_batch(averages);
+                        }));
             });
-        });
     }
     auto first() {
-        return make_observable<T>([this](const observer_t &next) {
-            bool is_first = true;
-            this->subscribe([&is_first, next](const T &value) {
-                if (is_first) {
-                    next(value);
-                    is_first = false;
-                }
+        return make_observable<T>(
+            [this, self = this->refc_from_this()](observer_t &&next, const subscription &sub) {
+                struct state_t {
+                    observer_t next;
+                    subscription upstream;
+                    bool is_first;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(next), sub.child(), true});
+                this->subscribe(state->upstream, [state](const T &value) {
+                    if (state->is_first) {
+                        state->next(value);
+                        state->is_first = false;
+                        state->upstream.dispose();
+                    }
+                });
             });
-        });
     }
 
+    // subscribes to the observable `mapper` makes of each element on `sched`,
+    // so inner sequences that wait (timers, lookups) overlap instead of
+    // queueing behind each other. at most `max_concurrency` of them run at
+    // once, the outer sequence waits for a slot. their elements are passed
+    // on one at a time, in the order they arrive.
     template <typename U, typename Fun>
-    auto flat_map(Fun &&mapper) { // Mapper<U> mapper) {
-        return make_observable<U>([this, mapper](const observer<U> &next) {
-            this->subscribe([mapper, next](const T &value) {
-                mapper(value)->subscribe(next);
+    auto flat_map(Fun &&mapper, size_t max_concurrency = SIZE_MAX,
+                  scheduler_ptr sched = schedulers::thread_pool()) { // Mapper<U> mapper) {
+        auto made = make_observable<U>([this, self = this->refc_from_this(), mapper, max_concurrency,
+                                        sched](observer<U> &&next, const subscription &sub) {
+            // the inner subscriptions run on after this returns if the outer
+            // sequence is hot, and themselves may be, so they own the state
+            struct state_t {
+                std::mutex mtx;
+                wait_list slots;
+                size_t active = 0;
+                std::mutex emit;
+                completion inners;
+                observer<U> next;
+                subscription sub;
+                metrics::context stage;
+            };
+            auto state = make_refc_ptr<state_t>();
+            state->next = std::move(next);
+            state->sub = sub;
+            size_t limit = std::max<size_t>(max_concurrency, 1);
+
+            // only the inner sequences are held to the downstream demand
+            this->subscribe(sub.unbounded_child(), [state, sched, mapper, limit](const T &value) {
+                auto inner = mapper(value);
+                {
+                    std::unique_lock<std::mutex> lock(state->mtx);
+                    if (!state->sub.wait_until(state->slots, lock, [&state, limit] {
+                            return state->active < limit;
+                        })) {
+                        return;
+                    }
+                    state->active++;
+                }
+                state->inners.add();
+                sched->schedule([state, inner] {
+                    metrics::context::resume as(state->stage);
+                    inner->subscribe(state->sub, [state](const U &element) {
+                        std::lock_guard<std::mutex> lock(state->emit);
+                        state->next(element);
+                    });
+                    {
+                        std::lock_guard<std::mutex> lock(state->mtx);
+                        state->active--;
+                    }
+                    state->slots.notify_all();
+                    state->inners.done();
+                });
             });
+            if (!this->is_hot()) {
+                state->inners.wait();
+            }
         });
+        // what `mapper` returns may be hot
+        made->set_hot(true);
+        return made;
     }
 
-    template <typename Period>
-    auto buffer_with_time(const Period &period) {
-        using U = std::vector<T>;
-        using clock_t = std::chrono::steady_clock;
+    // `fun` applied on `sched`, for transforms worth a thread of their own.
+    // elements go out in batches of `batch`, at most `2 * n` of them at once,
+    // and their results come back through a reorder buffer, so the downstream
+    // still sees them in source order, as batches, from whichever thread
+    // finished the oldest one. a slow source holds its last batch back until
+    // it fills up or the source completes. results go out as the downstream
+    // requests them, and the source waits while `2 * n` batches are held up.
+    template <typename F>
+    auto parallel_map(F &&fun, size_t n = std::thread::hardware_concurrency(), size_t batch = 256,
+                      scheduler_ptr sched = schedulers::thread_pool()) {
+        using U = std::decay_t<std::invoke_result_t<const std::decay_t<F> &, const T &>>;
+        using Fun = std::decay_t<F>;
+        return make_observable<U>([this, self = this->refc_from_this(), fun, n, batch,
+                                   sched](observer<U> &&obs, const subscription &sub) {
+            using output_t = typename vector_pool<U>::handle;
+            // owned by the callbacks and the batches in flight, a hot
+            // upstream returns before they are done
+            struct state_t {
+                std::mutex mtx;
+                wait_list room;
+                // results from the oldest batch not passed on yet, by sequence
+                // number. an empty handle is a batch still being worked on.
+                std::deque<output_t> reorder;
+                uint64_t head = 0;
+                uint64_t next = 0;
+                bool draining = false;
+                completion running;
+                metrics::queue_gauge depth;
+                Fun fun;
+                observer<U> obs;
+                subscription sub;
+                refc_ptr<vector_pool<T>> inputs = make_refc_ptr<vector_pool<T>>();
+                refc_ptr<vector_pool<U>> outputs = make_refc_ptr<vector_pool<U>>();
+                typename vector_pool<T>::handle pending;
 
-        return make_observable<U>([this, period](const observer<U> &on_next) {
-            U buffer = {};
+                state_t(const Fun &fun, observer<U> &&obs, const subscription &sub)
+                    : fun(fun)
+                    , obs(std::move(obs))
+                    , sub(sub) {}
 
-            auto when = clock_t::now() + period;
+                // one thread at a time passes on whatever is ready at the front
+                void drain() {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    if (draining) {
+                        return;
+                    }
+                    draining = true;
+                    while (!reorder.empty() && reorder.front()) {
+                        auto ready = std::move(reorder.front());
+                        reorder.pop_front();
+                        head++;
+                        room.notify_all();
+                        lock.unlock();
+                        // the downstream's demand is taken here, as the results
+                        // go out, and waited for if there is none
+                        detail::emit_batches<U>(obs, sub, ready->values.data(), ready->values.size());
+                        lock.lock();
+                    }
+                    draining = false;
+                }
+            };
+            auto state = make_refc_ptr<state_t>(fun, std::move(obs), sub);
+            size_t in_flight = 2 * std::max<size_t>(n, 1);
+            size_t chunk = std::max<size_t>(batch, 1);
+            state->pending = state->inputs->acquire(chunk);
+
+            auto dispatch = [state, sched, in_flight, chunk] {
+                uint64_t seq;
+                {
+                    std::unique_lock<std::mutex> lock(state->mtx);
+                    if (!state->sub.wait_until(state->room, lock, [&state, in_flight] {
+                            return state->reorder.size() < in_flight;
+                        })) {
+                        return;
+                    }
+                    state->reorder.emplace_back();
+                    state->depth.set(state->reorder.size());
+                    seq = state->next++;
+                }
+                auto input = std::exchange(state->pending, state->inputs->acquire(chunk));
+                state->running.add();
+                sched->schedule([state, seq, input] {
+                    auto output = state->outputs->acquire(input->values.size());
+                    for (const auto &value : input->values) {
+                        output->values.push_back(state->fun(value));
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(state->mtx);
+                        state->reorder[seq - state->head] = std::move(output);
+                    }
+                    state->drain();
+                    state->running.done();
+                });
+            };
 
+            // the source isn't held to the demand, a partial batch would wait
+            // for more of it forever. at most `in_flight` batches are ahead.
             this->subscribe(
-                [&buffer, &when, period, on_next](const T &val) {
-                    buffer.push_back(val);
-                    auto now = clock_t::now();
-                    if (now >= when) {
-                        on_next(buffer);
-                        buffer.clear();
-                        when = now + period;
+                sub.unbounded_child(),
+                [state, dispatch, chunk](const T &value) {
+                    state->pending->values.push_back(value);
+                    if (state->pending->values.size() == chunk) {
+                        dispatch();
                     }
                 },
-                [on_next, &buffer] {
-                    // clear out any remainders
-                    if (buffer.size() > 0) {
-                        on_next(buffer);
-                        buffer.clear();
+                [state, dispatch] {
+                    if (!state->pending->values.empty()) {
+                        dispatch();
                     }
                 });
+            if (!this->is_hot()) {
+                state->running.wait();
+            }
         });
     }
 
-    auto buffer_with_count(size_t n) {
-        using U = std::vector<T>;
+    // what arrived in each `period`, a non-empty batch per period. batches
+    // are vectors from `pool` that copy by reference and go back to it once
+    // the consumer drops them; one that wants to keep a batch can `take()`
+    // the vector instead.
+    template <typename Period>
+    auto buffer_with_time(const Period &period, refc_ptr<vector_pool<T>> pool = make_refc_ptr<vector_pool<T>>()) {
+        using U = pooled_vector<T>;
+        using clock_t = timer_wheel::clock_t;
 
-        return make_observable<U>([this, n](const observer<U> &on_next) {
-            U buffer = {};
+        return make_observable<U>(
+            [this, self = this->refc_from_this(), period, pool](observer<U> &&on_next, const subscription &sub) {
+                struct state_t {
+                    std::recursive_mutex mtx;
+                    typename vector_pool<T>::handle buffer;
+                    bool stopped = false;
+                    observer<U> on_next;
+                };
+                auto state = make_refc_ptr<state_t>();
+                state->on_next = std::move(on_next);
+                state->buffer = pool->acquire();
 
-            this->subscribe(
-                [&buffer, n, on_next](const T &val) {
-                    buffer.push_back(val);
-                    if (buffer.size() >= n) {
-                        on_next(buffer);
-                        buffer.clear();
-                    }
-                },
-                [on_next, &buffer] {
-                    // clear out any remainders
-                    if (!buffer.empty()) {
-                        on_next(buffer);
-                        buffer.clear();
+                // hands the batch on and starts a new one about its size
+                auto flush = [state, pool] {
+                    if (!state->buffer->values.empty()) {
+                        size_t size = state->buffer->values.size();
+                        state->on_next(U(std::exchange(state->buffer, pool->acquire(size))));
                     }
+                };
+
+                // flush on schedule, so a quiet stream still closes its buffer
+                auto when = clock_t::now() + period;
+                timer_wheel::instance().schedule_recurring(
+                    when, [state, flush, period, when]() mutable -> std::optional<clock_t::time_point> {
+                        std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                        if (state->stopped) {
+                            return std::nullopt;
+                        }
+                        flush();
+                        return when += period;
+                    });
+
+                this->subscribe(sub.unbounded_child(), [state](const T &val) {
+                    std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                    state->buffer->values.push_back(val);
                 });
+
+                // clear out any remainders
+                std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                flush();
+                state->stopped = true;
+            });
+    }
+
+    // batches of `n`, the last one possibly short. pooled like
+    // `buffer_with_time`'s.
+    auto buffer_with_count(size_t n, refc_ptr<vector_pool<T>> pool = make_refc_ptr<vector_pool<T>>()) {
+        using U = pooled_vector<T>;
+        n = std::max<size_t>(n, 1);
+
+        return make_observable<U>(
+            [this, self = this->refc_from_this(), n, pool](observer<U> &&on_next, const subscription &sub) {
+                struct state_t {
+                    observer<U> on_next;
+                    refc_ptr<vector_pool<T>> pool;
+                    typename vector_pool<T>::handle buffer;
+                    size_t n;
+
+                    void flush() { on_next(U(std::exchange(buffer, pool->acquire(n)))); }
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(on_next), pool, pool->acquire(n), n});
+
+                this->subscribe(
+                    sub.unbounded_child(),
+                    observer_t(
+                        [state](const T &val) {
+                            state->buffer->values.push_back(val);
+                            if (state->buffer->values.size() >= state->n) {
+                                state->flush();
+                            }
+                        },
+                        [state](span<const T> values) {
+                            while (!values.empty()) {
+                                auto &batch = state->buffer->values;
+                                auto take = std::min(state->n - batch.size(), values.size());
+                                batch.insert(batch.end(), values.begin(), values.begin() + take);
+                                values = values.subspan(take);
+                                if (batch.size() >= state->n) {
+                                    state->flush();
+                                }
+                            }
+                        }),
+                    [state] {
+                        // clear out any remainders
+                        if (!state->buffer->values.empty()) {
+                            state->on_next(U(std::move(state->buffer)));
+                        }
+                    });
+            });
+    }
+
+    // windows of `count` elements, a new one every `skip` (default `count`):
+    // tumbling if the two are equal, sliding if `skip` is less. a window is
+    // a view into a shared slab, so overlapping windows share their elements
+    // and none are copied for it. windows still open at the end go out short.
+    auto window_with_count(size_t count, size_t skip = 0) {
+        using U = slab_view<T>;
+        count = std::max<size_t>(count, 1);
+        skip = skip == 0 ? count : skip;
+
+        return make_observable<U>(
+            [this, self = this->refc_from_this(), count, skip](observer<U> &&on_next, const subscription &sub) {
+                struct state_t {
+                    observer<U> on_next;
+                    detail::slab_buffer<T> buffer;
+                    uint64_t seen;
+                    uint64_t next_end;
+                };
+                // room for a few windows, so moving one over to a fresh slab is rare
+                std::optional<state_t> local;
+                auto state = this->callback_state(
+                    local, state_t{std::move(on_next), detail::slab_buffer<T>(std::max<size_t>(4 * count, RX_BATCH_SIZE)),
+                                   0, count});
+
+                this->subscribe(
+                    sub.unbounded_child(),
+                    [state, count, skip](const T &value) {
+                        auto &buffer = state->buffer;
+                        buffer.push(value, count);
+                        if (++state->seen == state->next_end) {
+                            state->on_next(buffer.view(buffer.size() - count, buffer.size()));
+                            state->next_end += skip;
+                        }
+                    },
+                    [state, count, skip] {
+                        auto &buffer = state->buffer;
+                        for (uint64_t start = state->next_end - count; start < state->seen; start += skip) {
+                            state->on_next(
+                                buffer.view(buffer.size() - static_cast<size_t>(state->seen - start), buffer.size()));
+                        }
+                    });
+            });
+    }
+
+    // windows of what arrives within `length`, a new one every `shift`
+    // (default `length`), emitted on the timer thread as they close. like
+    // `window_with_count`, they are views into shared slabs. empty windows
+    // are skipped, the last one goes out at the end.
+    template <typename Duration>
+    auto window_with_time(const Duration &length) {
+        return window_with_time(length, length);
+    }
+
+    template <typename Duration, typename Shift>
+    auto window_with_time(const Duration &length, const Shift &shift) {
+        return windows_by_time<slab_view<T>>(length, shift, [](slab_view<T> &&view) {
+            return std::move(view);
         });
     }
 
+    // tumbling time windows as observables, each over a slab view
     template <typename Duration>
     auto window(const Duration &duration) {
-        using U = refc_ptr<observable<T>>; // std::vector<T>;
-        using clock_t = std::chrono::steady_clock;
-
-        return make_observable<U>([this, duration](const observer<U> &on_next) {
-            std::vector<T> buffer = {};
-            auto when = clock_t::now() + duration;
-            this->subscribe(
-                [on_next, &buffer, &when, duration](const T &val) {
-                    buffer.push_back(val);
-                    auto now = clock_t::now();
-                    if (now >= when) {
-                        auto inner = rx::from(buffer);
-                        on_next(inner);
-                        buffer.clear();
-                        when = now + duration;
-                    }
-                },
-                [on_next, &buffer] {
-                    // clear out any remainders
-                    if (buffer.size() > 0)
-                        on_next(rx::from(buffer));
-                });
+        return windows_by_time<refc_ptr<observable<T>>>(duration, duration, [](slab_view<T> &&view) {
+            return rx::from(std::move(view));
         });
     }
 
-    template <typename KeySelector> //, typename ValueSelector>
-    auto group_by(KeySelector key_for) {
-        using U = std::vector<T>;
-        using Y = refc_ptr<observable<T>>; // std::optional<std::pair<T,
-                                           // U>>;
-        return make_observable<Y>([this, key_for](const observer<Y> &on_next) {
-            std::unordered_map<T, U> buffer = {};
+    // splits the stream by `key_for(value)`. a group goes out the first time
+    // its key shows up and gets that key's elements as they arrive, so it
+    // works on endless streams. with an `idle` timeout a group that saw
+    // nothing for that long is ended and dropped, and the key's next element
+    // starts a new one.
+    template <typename KeySelector>
+    auto group_by(KeySelector key_for, timer_wheel::clock_t::duration idle = {}) {
+        using K = std::decay_t<std::invoke_result_t<KeySelector &, const T &>>;
+        using G = grouped_observable<K, T>;
+        using Y = refc_ptr<G, refc_policy>;
+        using clock_t = timer_wheel::clock_t;
 
-            this->subscribe(
-                [on_next, &buffer, key_for](const T &value) {
-                    buffer[key_for(value)].push_back(value);
-                },
-                [on_next, &buffer] {
-                    for (auto group : buffer) {
-                        on_next(rx::from(group.second));
+        return make_observable<Y>(
+            [this, self = this->refc_from_this(), key_for, idle](observer<Y> &&on_next, const subscription &sub) {
+                struct entry_t {
+                    Y group;
+                    clock_t::time_point last;
+                };
+                // a hot upstream keeps calling after this returns, so the
+                // callbacks own everything they use
+                struct state_t {
+                    observer<Y> on_next;
+                    KeySelector key_for;
+                    std::recursive_mutex mtx;
+                    flat_hash_map<K, entry_t> groups;
+                    bool stopped = false;
+
+                    state_t(observer<Y> &&on_next, const KeySelector &key_for)
+                        : on_next(std::move(on_next))
+                        , key_for(key_for) {}
+
+                    // once the upstream is done, the groups are too
+                    void end() {
+                        std::lock_guard<std::recursive_mutex> lock(mtx);
+                        if (stopped) {
+                            return;
+                        }
+                        stopped = true;
+                        groups.for_each([](const K &, entry_t &entry) {
+                            entry.group->end();
+                        });
+                        groups.clear();
                     }
+                };
+                auto state = make_refc_ptr<state_t>(std::move(on_next), key_for);
+
+                if (idle > clock_t::duration::zero()) {
+                    auto when = clock_t::now() + idle;
+                    timer_wheel::instance().schedule_recurring(
+                        when, [state, idle, when]() mutable -> std::optional<clock_t::time_point> {
+                            std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                            if (state->stopped) {
+                                return std::nullopt;
+                            }
+                            auto now = clock_t::now();
+                            state->groups.erase_if([now, idle](const K &, entry_t &entry) {
+                                if (now - entry.last < idle) {
+                                    return false;
+                                }
+                                entry.group->end();
+                                return true;
+                            });
+                            return when += idle;
+                        });
+                }
+
+                auto upstream = sub.unbounded_child();
+                this->subscribe(upstream, [state, idle](const T &value) {
+                    std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                    if (state->stopped) {
+                        return;
+                    }
+                    const K &key = state->key_for(value);
+                    auto found = state->groups.try_emplace(key);
+                    auto &entry = *found.first;
+                    if (found.second) {
+                        entry.group = make_refc_ptr<G>(key);
+                    }
+                    if (idle > clock_t::duration::zero()) {
+                        entry.last = clock_t::now();
+                    }
+                    // the entry may move once downstream runs, the group won't
+                    auto group = entry.group;
+                    if (found.second) {
+                        state->on_next(group);
+                    }
+                    group->deliver(value);
                 });
-        });
+                // a cold upstream is done here, a hot one when disposed
+                if (this->is_hot()) {
+                    upstream.add([state] {
+                        state->end();
+                    });
+                } else {
+                    state->end();
+                }
+            });
     }
 
     template <typename U>
     auto if_then_else(std::function<bool(const T &)> predicate, const refc_ptr<observable<U>> &then_,
                       const refc_ptr<observable<U>> &else_) {
-        return make_observable<U>([this, predicate, then_, else_](const observer<U> &on_next) {
-            this->subscribe([predicate, then_, else_, on_next](const T &value) {
-                if (predicate(value)) {
-                    then_->subscribe(on_next);
-                } else {
-                    else_->subscribe(on_next);
-                }
+        auto made = make_observable<U>(
+            [this, self = this->refc_from_this(), predicate, then_, else_](observer<U> &&on_next,
+                                                                           const subscription &sub) {
+                auto outer = sub.unbounded_child();
+                this->subscribe(outer, [predicate, then_, else_, sub, on_next = std::move(on_next)](const T &value) {
+                    auto forward = [&on_next](const U &inner) {
+                        on_next(inner);
+                    };
+                    if (predicate(value)) {
+                        then_->subscribe(sub, forward);
+                    } else {
+                        else_->subscribe(sub, forward);
+                    }
+                });
             });
-        });
+        made->set_hot(this->is_hot() || then_->is_hot() || else_->is_hot());
+        return made;
     }
 
     template <typename Period>
     auto sample(Period period) {
-        using clock_t = std::chrono::steady_clock;
-
-        return make_observable<T>([this, period](const observer_t &obs) {
-            auto timer = clock_t::now() + period;
-            this->subscribe([&timer, period, obs](const T &value) {
-                if (clock_t::now() >= timer) {
-                    obs(value);
-                    timer += period;
-                }
+        using clock_t = timer_wheel::clock_t;
+
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), period](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    std::recursive_mutex mtx;
+                    std::optional<T> latest;
+                    bool stopped = false;
+                    observer_t obs;
+                };
+                auto state = make_refc_ptr<state_t>();
+                state->obs = std::move(obs);
+
+                // emit the most recent value once per period, if there is a new one
+                auto when = clock_t::now() + period;
+                timer_wheel::instance().schedule_recurring(
+                    when, [state, period, when]() mutable -> std::optional<clock_t::time_point> {
+                        std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                        if (state->stopped) {
+                            return std::nullopt;
+                        }
+                        if (state->latest) {
+                            state->obs(*state->latest);
+                            state->latest.reset();
+                        }
+                        return when += period;
+                    });
+
+                this->subscribe(sub.unbounded_child(), [state](const T &value) {
+                    std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                    state->latest = value;
+                });
+
+                std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                state->stopped = true;
             });
-        });
     }
 
     template <typename Predicate>
     auto skip_while(Predicate predicate) {
-        return make_observable<T>([this, predicate](const observer_t &on_next) {
-            bool is_skipping = true;
-            this->subscribe([predicate, on_next, &is_skipping](const T &value) {
-                if (is_skipping && predicate(value)) {
-                    return;
-                }
-                is_skipping = false;
-                on_next(value);
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), predicate](observer_t &&on_next, const subscription &sub) {
+                struct state_t {
+                    observer_t on_next;
+                    bool is_skipping;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(on_next), true});
+                this->subscribe(sub, [state, predicate, sub](const T &value) {
+                    if (state->is_skipping && predicate(value)) {
+                        sub.request(1);
+                        return;
+                    }
+                    state->is_skipping = false;
+                    state->on_next(value);
+                });
             });
-        });
     }
 
     template <typename Predicate>
     auto all(Predicate predicate) {
-        return make_observable<bool>([this, predicate](const observer_t &on_next) {
-            bool ret = true;
-            this->subscribe(
-                [predicate, on_next, &ret](const T &value) {
-                    if (!predicate(value)) {
-                        ret = false;
-                        throw on_complete();
-                    }
-                },
-                [on_next, &ret]() {
-                    on_next(ret);
-                });
-        });
+        return make_observable<bool>(
+            [this, self = this->refc_from_this(), predicate](observer<bool> &&on_next, const subscription &sub) {
+                struct state_t {
+                    observer<bool> on_next;
+                    subscription upstream;
+                    bool ret;
+                };
+                std::optional<state_t> local;
+                auto state =
+                    this->callback_state(local, state_t{std::move(on_next), sub.child(subscription::unbounded), true});
+                this->subscribe(
+                    state->upstream,
+                    observer_t(
+                        [state, predicate](const T &value) {
+                            if (state->ret && !predicate(value)) {
+                                state->ret = false;
+                                state->upstream.dispose();
+                            }
+                        },
+                        [state, predicate](span<const T> values) {
+                            if (state->ret && !simd::all_of(values, predicate)) {
+                                state->ret = false;
+                                state->upstream.dispose();
+                            }
+                        }),
+                    [state]() {
+                        state->on_next(state->ret);
+                    });
+            });
     }
 
     template <typename U = size_t>
     auto count() {
-        return make_observable<size_t>([this](const observer<U> &on_next) {
-            U count = 0;
-            this->subscribe(
-                [&count](const T &t) {
-                    count++;
-                },
-                [on_next, &count] {
-                    on_next(count);
-                });
-        });
+        return make_observable<size_t>(
+            [this, self = this->refc_from_this()](observer<U> &&on_next, const subscription &sub) {
+                struct state_t {
+                    observer<U> on_next;
+                    U count;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(on_next), 0});
+                this->subscribe(
+                    sub.unbounded_child(),
+                    observer_t(
+                        [state](const T &) {
+                            state->count++;
+                        },
+                        [state](span<const T> values) {
+                            state->count += values.size();
+                        }),
+                    [state] {
+                        state->on_next(state->count);
+                    });
+            });
+    }
+
+    template <typename Predicate>
+    auto count_if(Predicate predicate) {
+        return make_observable<size_t>(
+            [this, self = this->refc_from_this(), predicate](observer<size_t> &&on_next, const subscription &sub) {
+                struct state_t {
+                    observer<size_t> on_next;
+                    size_t count;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(on_next), 0});
+                this->subscribe(
+                    sub.unbounded_child(),
+                    observer_t(
+                        [state, predicate](const T &t) {
+                            state->count += predicate(t) ? 1 : 0;
+                        },
+                        [state, predicate](span<const T> values) {
+                            state->count += simd::count_if(values, predicate);
+                        }),
+                    [state] {
+                        state->on_next(state->count);
+                    });
+            });
     }
 
     template <typename U>
     auto to(std::function<U(const T &)> mapper) {
-        return make_observable<U>([this, mapper](std::function<void(const U &)> on_next) {
-            this->subscribe([mapper, on_next](const T &value) {
-                on_next(mapper(value));
+        return make_observable<U>(
+            [this, self = this->refc_from_this(), mapper](observer<U> &&on_next, const subscription &sub) {
+                this->subscribe(sub, [mapper, on_next = std::move(on_next)](const T &value) {
+                    on_next(mapper(value));
+                });
             });
-        });
     }
 
     template <typename Container>
     auto to_iterable() {
-        return make_observable<Container>([this](const observer<Container> &on_next) {
-            Container res = {};
-            auto o_first = std::back_inserter(res);
+        return make_observable<Container>(
+            [this, self = this->refc_from_this()](observer<Container> &&on_next, const subscription &sub) {
+                struct state_t {
+                    observer<Container> on_next;
+                    Container res;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(on_next), {}});
 
-            this->subscribe(
-                [&o_first](const T &t) {
-                    *o_first++ = t;
-                },
-                [on_next, &res] {
-                    on_next(res);
+                this->subscribe(
+                    sub.unbounded_child(),
+                    observer_t(
+                        [state](const T &t) {
+                            state->res.push_back(t);
+                        },
+                        [state](span<const T> values) {
+                            std::copy(values.begin(), values.end(), std::back_inserter(state->res));
+                        }),
+                    [state] {
+                        state->on_next(state->res);
+                    });
+            });
+    }
+
+    // run the upstream subscription on `sched`. the subscribing thread waits
+    // for it, so completion still means "the source is done".
+    auto subscribe_on(const scheduler_ptr &sched) {
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), sched](observer_t &&obs, const subscription &sub) {
+                // the task owns what it uses, a hot upstream keeps calling
+                // `obs` after it is done
+                auto done = make_refc_ptr<completion>();
+                done->add();
+                metrics::context stage;
+                sched->schedule([this, self, sub, done, stage, obs = std::move(obs)] {
+                    metrics::context::resume as(stage);
+                    this->subscribe(sub, obs);
+                    done->done();
                 });
-        });
+                done->wait();
+            });
     }
 
-    template <typename U, typename... Ts>
-    static auto make_observable(Ts &&...args) {
-        return make_refc_ptr<observable<U>>(std::forward<Ts>(args)...);
+    // hand every element to `sched`. elements are queued in order and drained
+    // by a single task at a time, so downstream never sees concurrent or
+    // reordered calls while the producer keeps running. the upstream gets a
+    // demand of `capacity`, topped up as elements are delivered, so a source
+    // that acquires its demand never runs more than that ahead.
+    auto observe_on(const scheduler_ptr &sched, size_t capacity = 1024) {
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), sched, capacity](observer_t &&obs, const subscription &sub) {
+                // owned by the upstream callback and the drain tasks, a hot
+                // upstream returns before they are done
+                struct state_t {
+                    std::mutex mtx;
+                    std::deque<T> queue;
+                    bool draining = false;
+                    completion idle;
+                    metrics::queue_gauge depth;
+                    observer_t obs;
+                    subscription sub;
+                    subscription upstream;
+
+                    void drain() {
+                        std::deque<T> batch;
+                        while (true) {
+                            {
+                                std::lock_guard<std::mutex> lock(mtx);
+                                if (queue.empty()) {
+                                    draining = false;
+                                    break;
+                                }
+                                batch.swap(queue);
+                            }
+                            for (const auto &value : batch) {
+                                if (!sub.acquire()) {
+                                    break;
+                                }
+                                obs(value);
+                            }
+                            upstream.request(static_cast<long>(batch.size()));
+                            batch.clear();
+                        }
+                        idle.done();
+                    }
+                };
+                auto state = make_refc_ptr<state_t>();
+                state->obs = std::move(obs);
+                state->sub = sub;
+                state->upstream = sub.child(static_cast<long>(capacity));
+
+                this->subscribe(state->upstream, [state, sched](const T &value) {
+                    bool start = false;
+                    {
+                        std::lock_guard<std::mutex> lock(state->mtx);
+                        state->queue.push_back(value);
+                        state->depth.set(state->queue.size());
+                        start = !state->draining;
+                        state->draining = true;
+                    }
+                    if (start) {
+                        state->idle.add();
+                        sched->schedule([state] {
+                            state->drain();
+                        });
+                    }
+                });
+                if (!this->is_hot()) {
+                    state->idle.wait();
+                }
+            });
+    }
+
+    // backpressure strategies, for sources that won't wait for demand
+    // (subjects, sockets read on someone else's schedule): the upstream runs
+    // unbounded and the operator decides what happens to elements the
+    // downstream hasn't asked for yet.
+
+    // drops them
+    auto on_backpressure_drop() {
+        return make_observable<T>(
+            [this, self = this->refc_from_this()](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    observer_t obs;
+                };
+                std::optional<state_t> local;
+                auto state = this->callback_state(local, state_t{std::move(obs)});
+                this->subscribe(sub.unbounded_child(), [state, sub](const T &value) {
+                    if (sub.try_acquire()) {
+                        state->obs(value);
+                    }
+                });
+            });
+    }
+
+    // keeps only the most recent one, handed out as soon as there is demand
+    auto on_backpressure_latest() {
+        return make_observable<T>(
+            [this, self = this->refc_from_this()](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    std::recursive_mutex mtx;
+                    wait_list taken;
+                    std::optional<T> latest;
+                    observer_t obs;
+                    subscription sub;
+
+                    void emit() {
+                        std::lock_guard<std::recursive_mutex> lock(mtx);
+                        if (latest && sub.try_acquire()) {
+                            auto value = std::move(*latest);
+                            latest.reset();
+                            taken.notify_all();
+                            obs(value);
+                        }
+                    }
+                };
+                auto state = make_refc_ptr<state_t>();
+                state->obs = std::move(obs);
+                state->sub = sub;
+                sub.on_request([state] {
+                    state->emit();
+                });
+
+                this->subscribe(sub.unbounded_child(), [state](const T &value) {
+                    std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                    state->latest = value;
+                    state->emit();
+                });
+
+                // a hot upstream isn't done yet, the hook hands out what it
+                // sends later until the subscription is disposed
+                if (this->is_hot()) {
+                    sub.add([sub] {
+                        sub.on_request(nullptr);
+                    });
+                    return;
+                }
+                // the last value still goes out, once it is asked for
+                std::unique_lock<std::recursive_mutex> lock(state->mtx);
+                state->emit();
+                sub.wait_until(state->taken, lock, [&state] {
+                    return !state->latest;
+                });
+                sub.on_request(nullptr);
+            });
+    }
+
+    // queues up to `n` of them. when the queue is full the producer waits for
+    // room, so memory stays bounded even for sources that never acquire.
+    auto on_backpressure_buffer(size_t n) {
+        return make_observable<T>(
+            [this, self = this->refc_from_this(), n](observer_t &&obs, const subscription &sub) {
+                struct state_t {
+                    std::recursive_mutex mtx;
+                    wait_list room;
+                    std::deque<T> queue;
+                    observer_t obs;
+                    subscription sub;
+                    metrics::queue_gauge depth;
+
+                    // pops before emitting, a downstream that requests from
+                    // inside on_next re-enters here
+                    void drain() {
+                        std::lock_guard<std::recursive_mutex> lock(mtx);
+                        while (!queue.empty() && sub.try_acquire()) {
+                            auto value = std::move(queue.front());
+                            queue.pop_front();
+                            depth.set(queue.size());
+                            room.notify_all();
+                            obs(value);
+                        }
+                    }
+                };
+                auto state = make_refc_ptr<state_t>();
+                state->obs = std::move(obs);
+                state->sub = sub;
+                sub.on_request([state] {
+                    state->drain();
+                });
+
+                this->subscribe(sub.unbounded_child(), [state, n](const T &value) {
+                    std::unique_lock<std::recursive_mutex> lock(state->mtx);
+                    state->drain();
+                    if (state->sub.wait_until(state->room, lock, [&state, n] {
+                            return state->queue.size() < n;
+                        })) {
+                        state->queue.push_back(value);
+                        state->depth.set(state->queue.size());
+                        state->drain();
+                    }
+                });
+
+                // a hot upstream isn't done yet, the hook drains what it
+                // queues later until the subscription is disposed
+                if (this->is_hot()) {
+                    sub.add([sub] {
+                        sub.on_request(nullptr);
+                    });
+                    return;
+                }
+                std::unique_lock<std::recursive_mutex> lock(state->mtx);
+                state->drain();
+                sub.wait_until(state->room, lock, [&state] {
+                    return state->queue.empty();
+                });
+                sub.on_request(nullptr);
+            });
+    }
+
+    // an operator on this observable, `name`d after the operator function
+    template <typename U, typename F>
+    auto make_observable(F &&fun, const char *name = __builtin_FUNCTION()) {
+        auto made = make_refc_ptr<observable<U>>(std::forward<F>(fun));
+        made->set_hot(_hot);
+#ifdef RX_METRICS
+        auto own = metrics::function_name(name);
+        made->set_name(_name.empty() ? own : _name + "/" + own);
+#else
+        (void)name;
+#endif
+        return made;
     }
 }; // observable
 
-// helper
-template <typename T, typename... Args>
-static auto make_observable(Args &&...args) {
-    return make_refc_ptr<observable<T>>(std::forward<Args>(args)...);
+// one group of `group_by`. groups are hot: subscribing registers the
+// observer and returns right away, and the elements of the key reach it as
+// they arrive. `lifetime()` is disposed once the group ends, because its
+// upstream completed or it was idle for too long.
+template <typename K, typename T>
+class grouped_observable : public observable<T> {
+    struct entry_t {
+        uint64_t id;
+        observer<T> next;
+    };
+
+    K _key;
+    subscription _lifetime;
+    std::recursive_mutex _mtx;
+    std::vector<refc_ptr<entry_t>> _entries;
+    std::vector<typename observable<T>::completer_t> _completers;
+    uint64_t _next_id = 1;
+
+    void add(observer<T> &&next, const subscription &sub) {
+        uint64_t id;
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mtx);
+            if (_lifetime.is_disposed()) {
+                return;
+            }
+            id = _next_id++;
+            auto entry = make_refc_ptr<entry_t>();
+            entry->id = id;
+            entry->next = std::move(next);
+            _entries.push_back(std::move(entry));
+        }
+        sub.add([self = this->refc_from_this(), this, id] {
+            std::lock_guard<std::recursive_mutex> lock(_mtx);
+            auto it = std::find_if(_entries.begin(), _entries.end(), [id](const auto &entry) {
+                return entry->id == id;
+            });
+            if (it != _entries.end()) {
+                _entries.erase(it);
+            }
+        });
+    }
+
+  public:
+    explicit grouped_observable(K key)
+        : observable<T>([this](observer<T> &&next, const subscription &sub) {
+            add(std::move(next), sub);
+        })
+        , _key(std::move(key)) {
+        this->set_hot(true);
+    }
+
+    const K &key() const { return _key; }
+    const subscription &lifetime() const { return _lifetime; }
+
+    void deliver(const T &value) {
+        std::lock_guard<std::recursive_mutex> lock(_mtx);
+        // an observer may subscribe or unsubscribe from in here
+        for (size_t i = 0; i < _entries.size(); i++) {
+            auto entry = _entries[i];
+            entry->next(value);
+        }
+    }
+
+    void end() {
+        std::vector<typename observable<T>::completer_t> completers;
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mtx);
+            _entries.clear();
+            completers.swap(_completers);
+        }
+        _lifetime.dispose();
+        for (auto &done : completers) {
+            done();
+        }
+    }
+
+  protected:
+    // completers wait for the group to end
+    void completed(typename observable<T>::completer_t &&done) override {
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mtx);
+            if (!_lifetime.is_disposed()) {
+                _completers.push_back(std::move(done));
+                return;
+            }
+        }
+        done();
+    }
+};
+
+// helper, for sources. they are `name`d after the function that makes them.
+template <typename T, typename F>
+static auto make_observable(F &&fun, const char *name = __builtin_FUNCTION()) {
+    auto made = make_refc_ptr<observable<T>>(std::forward<F>(fun));
+#ifdef RX_METRICS
+    made->set_name(metrics::function_name(name));
+#else
+    (void)name;
+#endif
+    return made;
 }
 
 template <typename T>
 static auto defer(std::function<observable<T>()> factory) {
-    return make_observable<T>([factory](const observer<T> &on_next) {
-        factory().subscribe(on_next);
+    auto made = make_observable<T>([factory](const observer<T> &on_next, const subscription &sub) {
+        factory().subscribe(sub, on_next);
     });
-    throw on_complete();
+    // no telling what `factory` makes
+    made->set_hot(true);
+    return made;
 }
 
+// ticks on the run loop thread, starting right away, until disposed. the
+// subscribing thread only waits. a tick that finds no demand is dropped.
 template <typename T, typename Period>
 static auto interval(const Period &a_while) {
-    using clock_t = std::chrono::steady_clock;
-    return make_observable<T>([=](const observer<T> &next) {
-        T count = T{0};
-        while (true) {
-            next(count++);
-            std::this_thread::sleep_for(a_while);
-        }
-        throw on_complete();
+    using clock_t = run_loop::clock_t;
+    auto period = std::chrono::duration_cast<clock_t::duration>(a_while);
+    return make_observable<T>([period](const observer<T> &next, const subscription &sub) {
+        struct state_t {
+            std::mutex mtx;
+            wait_list idle; // woken when a tick leaves `next`
+            bool stopped = false;
+            bool ticking = false;
+            T count = T{0};
+        };
+        auto state = make_refc_ptr<state_t>();
+        auto &loop = run_loop::instance();
+
+        auto when = clock_t::now();
+        auto id = loop.schedule_recurring(when, [state, &next, sub, period, when]() mutable
+                                          -> std::optional<clock_t::time_point> {
+            {
+                std::lock_guard<std::mutex> lock(state->mtx);
+                if (state->stopped) {
+                    return std::nullopt;
+                }
+                state->ticking = true;
+            }
+            // not under the lock: `next` may request or dispose, which takes
+            // the subscription's lock, and dispose takes this one under it
+            if (sub.try_acquire()) {
+                next(state->count++);
+            }
+            {
+                std::lock_guard<std::mutex> lock(state->mtx);
+                state->ticking = false;
+            }
+            state->idle.notify_all();
+            return when += period;
+        });
+        sub.add([state, id, &loop] {
+            {
+                std::lock_guard<std::mutex> lock(state->mtx);
+                state->stopped = true;
+            }
+            loop.cancel(id);
+        });
+        sub.wait();
+        // a tick that started before the dispose may still be in `next`
+        std::unique_lock<std::mutex> lock(state->mtx);
+        wait_until(state->idle, lock, [&state] {
+            return !state->ticking;
+        });
     });
 }
 template <typename T>
 static auto repeat(T value, size_t count) {
-    return make_observable<T>([=](const observer<T> &next) {
-        for (size_t i = 0; i < count; i++) {
-            next(value);
+    return make_observable<T>([=](const observer<T> &next, const subscription &sub) {
+        if (!next.has_batch()) {
+            for (size_t i = 0; i < count && sub.acquire(); i++) {
+                next(value);
+            }
+            return;
+        }
+        // one block of copies, handed out as often as needed
+        std::vector<T> block(std::min<size_t>(count, RX_BATCH_SIZE), value);
+        for (size_t i = 0; i < count;) {
+            size_t n = std::min(count - i, block.size());
+            detail::emit_batches<T>(next, sub, block.data(), n);
+            if (sub.is_disposed()) {
+                break;
+            }
+            i += n;
         }
-        throw on_complete();
     });
 }
 
 template <typename Iterable>
 auto from(Iterable iterable) {
-    using T = typename std::remove_reference<decltype(*iterable.begin())>::type;
-    return make_observable<T>([iterable](const typename observable<T>::observer_t next) {
+    using T = std::decay_t<decltype(*iterable.begin())>;
+    return make_observable<T>([iterable](const typename observable<T>::observer_t next, const subscription &sub) {
+        if constexpr (detail::is_contiguous<Iterable>::value) {
+            detail::emit_batches<T>(next, sub, std::data(iterable), std::size(iterable));
+            return;
+        }
         for (auto i : iterable) {
+            if (!sub.acquire()) {
+                break;
+            }
             next(i);
         }
-        throw on_complete();
     });
 }
 
 template <typename... Ts>
 auto of(Ts &&...ts) {
     using T = typename std::common_type<Ts...>::type;
-    return make_observable<T>([ts...](const observer<T> &next) {
+    return make_observable<T>([ts...](const observer<T> &next, const subscription &sub) {
         std::initializer_list<T> list{(ts)...};
         for (auto i : list) {
+            if (!sub.acquire()) {
+                break;
+            }
             next(i);
         }
-        throw on_complete();
     });
 }
 template <typename T>
 static auto range(T start, T count) {
-    return make_observable<T>([start, count](const observer<T> &obs) {
-        for (T i = start; i < start + count; ++i) {
-            obs(i);
+    return make_observable<T>([start, count](const observer<T> &obs, const subscription &sub) {
+        if (!obs.has_batch()) {
+            for (T i = start; i < start + count && sub.acquire(); ++i) {
+                obs(i);
+            }
+            return;
+        }
+        std::vector<T> block;
+        for (T i = start; i < start + count;) {
+            size_t n = sub.acquire(std::min<size_t>(static_cast<size_t>(start + count - i), RX_BATCH_SIZE));
+            if (n == 0) {
+                break;
+            }
+            block.clear();
+            for (size_t k = 0; k < n; k++, ++i) {
+                block.push_back(i);
+            }
+            obs.on_next_batch(block);
         }
-        throw on_complete();
     });
 }
 
 template <typename Fun>
 auto start(Fun &&factory) {
     using T = typename std::invoke_result<Fun>::type;
-    return make_observable<T>([factory](const observer<T> &on_next) {
-        on_next(factory());
+    return make_observable<T>([factory](const observer<T> &on_next, const subscription &sub) {
+        if (sub.acquire()) {
+            on_next(factory());
+        }
+    });
+}
+
+// subscribes to all of `sources` at once, as `flat_map` does with its inner
+// sequences
+template <typename T>
+auto merge(std::vector<shared_observable<T>> sources, size_t max_concurrency = SIZE_MAX,
+           scheduler_ptr sched = schedulers::thread_pool()) {
+    return from(std::move(sources))
+        ->template flat_map<T>(
+            [](const shared_observable<T> &source) {
+                return source;
+            },
+            max_concurrency, std::move(sched));
+}
+
+template <typename T, typename... Sources>
+auto merge(const shared_observable<T> &first, const Sources &...rest) {
+    return merge(std::vector<shared_observable<T>>{first, rest...});
+}
+
+// subscribes to `sources` one after the other, on the subscribing thread
+template <typename T>
+auto concat(std::vector<shared_observable<T>> sources) {
+    bool hot = std::any_of(sources.begin(), sources.end(), [](const shared_observable<T> &source) {
+        return source->is_hot();
+    });
+    auto made = make_observable<T>([sources](const observer<T> &next, const subscription &sub) {
+        for (const auto &source : sources) {
+            if (sub.is_disposed()) {
+                break;
+            }
+            source->subscribe(sub, next);
+        }
+    });
+    made->set_hot(hot);
+    return made;
+}
+
+template <typename T, typename... Sources>
+auto concat(const shared_observable<T> &first, const Sources &...rest) {
+    return concat(std::vector<shared_observable<T>>{first, rest...});
+}
+
+namespace detail {
+
+// subscribes to each of `sources` with the matching one of `subs`, each on
+// a thread of its own, the last one on the calling thread, and waits for all
+// of them. not on a scheduler: a source held back by its demand waits for
+// the others, which a worker can only run on top of it, so they would never
+// let it go. `on_next(i, value)` and `on_done(i)` get the position `i` of the
+// source as an integral_constant.
+template <typename Sources, typename Next, typename Done, size_t... Is>
+void subscribe_each(const Sources &sources, const std::vector<subscription> &subs, Next &on_next, Done &on_done,
+                    std::index_sequence<Is...>) {
+    std::vector<std::thread> threads;
+    metrics::context stage;
+    auto run = [&sources, &subs, &on_next, &on_done, &stage](auto index) {
+        constexpr size_t i = decltype(index)::value;
+        metrics::context::resume as(stage);
+        std::get<i>(sources)->subscribe(subs[i], [&on_next](const auto &value) {
+            on_next(std::integral_constant<size_t, i>(), value);
+        });
+        on_done(index);
+    };
+    (
+        [&threads, &run](auto index) {
+            if (decltype(index)::value + 1 < sizeof...(Is)) {
+                threads.emplace_back(run, index);
+            } else {
+                run(index);
+            }
+        }(std::integral_constant<size_t, Is>()),
+        ...);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+} // namespace detail
+
+// pairs the elements of `sources` up by position, the n-th tuple holds the
+// n-th element of each. the sources run at once, none more than 1024
+// elements ahead of the slowest, and the first one to run out ends the
+// sequence.
+template <typename... Ts>
+auto zip(const shared_observable<Ts> &...sources) {
+    using tuple_t = std::tuple<Ts...>;
+    auto made = make_observable<tuple_t>([sources = std::make_tuple(sources...)](const observer<tuple_t> &next,
+                                                                                 const subscription &sub) {
+        struct {
+            std::mutex mtx;
+            std::tuple<std::deque<Ts>...> queues;
+            std::array<bool, sizeof...(Ts)> done = {};
+            metrics::queue_gauge depth;
+        } state;
+        subscription upstream = sub.child();
+        std::vector<subscription> subs;
+        for (size_t i = 0; i < sizeof...(Ts); i++) {
+            subs.push_back(upstream.child(1024));
+        }
+
+        // a source that is done and has nothing queued can't fill a tuple again
+        auto exhausted = [&state] {
+            size_t i = 0;
+            return std::apply(
+                [&state, &i](const auto &...queue) {
+                    return ((state.done[i++] && queue.empty()) || ...);
+                },
+                state.queues);
+        };
+        auto on_next = [&state, &next, &subs, &upstream, &exhausted](auto index, const auto &value) {
+            bool emitted = false;
+            bool stop = false;
+            {
+                std::lock_guard<std::mutex> lock(state.mtx);
+                auto &queue = std::get<decltype(index)::value>(state.queues);
+                queue.push_back(value);
+                state.depth.set(queue.size());
+                bool ready = std::apply(
+                    [](const auto &...queue) {
+                        return (!queue.empty() && ...);
+                    },
+                    state.queues);
+                if (ready) {
+                    auto row = std::apply(
+                        [](auto &...queue) {
+                            tuple_t front(std::move(queue.front())...);
+                            (queue.pop_front(), ...);
+                            return front;
+                        },
+                        state.queues);
+                    next(row);
+                    emitted = true;
+                    stop = exhausted();
+                }
+            }
+            // disposing runs the sources' teardowns, which may wait for a
+            // source that is waiting for the lock
+            if (stop) {
+                upstream.dispose();
+            } else if (emitted) {
+                for (const auto &source : subs) {
+                    source.request(1);
+                }
+            }
+        };
+        auto on_done = [&state, &upstream, &exhausted](auto index) {
+            bool stop = false;
+            {
+                std::lock_guard<std::mutex> lock(state.mtx);
+                state.done[decltype(index)::value] = true;
+                stop = exhausted();
+            }
+            if (stop) {
+                upstream.dispose();
+            }
+        };
+        detail::subscribe_each(sources, subs, on_next, on_done, std::index_sequence_for<Ts...>());
+    });
+    made->set_hot((sources->is_hot() || ...));
+    return made;
+}
+
+// the latest element of each of `sources`, every time one of them emits once
+// all of them have. the sources run at once.
+template <typename... Ts>
+auto combine_latest(const shared_observable<Ts> &...sources) {
+    using tuple_t = std::tuple<Ts...>;
+    auto made = make_observable<tuple_t>([sources = std::make_tuple(sources...)](const observer<tuple_t> &next,
+                                                                                 const subscription &sub) {
+        struct {
+            std::mutex mtx;
+            std::tuple<std::optional<Ts>...> latest;
+        } state;
+        // emits on any element, so the sources aren't held to the demand
+        subscription upstream = sub.child(subscription::unbounded);
+        std::vector<subscription> subs(sizeof...(Ts), upstream);
+
+        auto on_next = [&state, &next](auto index, const auto &value) {
+            std::lock_guard<std::mutex> lock(state.mtx);
+            std::get<decltype(index)::value>(state.latest) = value;
+            std::apply(
+                [&next](const auto &...latest) {
+                    if ((latest && ...)) {
+                        next(tuple_t(*latest...));
+                    }
+                },
+                state.latest);
+        };
+        // one that ended without an element leaves nothing to combine
+        auto on_done = [&state, &upstream](auto index) {
+            bool stop = false;
+            {
+                std::lock_guard<std::mutex> lock(state.mtx);
+                stop = !std::get<decltype(index)::value>(state.latest);
+            }
+            if (stop) {
+                upstream.dispose();
+            }
+        };
+        detail::subscribe_each(sources, subs, on_next, on_done, std::index_sequence_for<Ts...>());
     });
-    throw on_complete();
+    made->set_hot((sources->is_hot() || ...));
+    return made;
 }
 
-template <typename T, typename Traits = std::char_traits<T>>
-static auto from_istream(std::basic_istream<T, Traits> &iss) {
-    using char_type = typename std::basic_istream<T, Traits>::char_type;
-    return make_observable<char_type>([&iss](const observer<char_type> &on_next) {
-        while (!iss.eof() && !iss.bad()) {
-            T value;
-            iss >> value;
-            if (iss.fail()) {
+// a parsed value and the byte offset of its text, for sources that can
+// tell where it came from (`from_file<rx::positioned<int>>`)
+template <typename T>
+struct positioned {
+    T value;
+    uint64_t offset;
+};
+
+namespace detail {
+
+template <typename T>
+struct parsed {
+    using type = T;
+    static T make(T value, uint64_t) { return value; }
+};
+
+template <typename T>
+struct parsed<positioned<T>> {
+    using type = T;
+    static positioned<T> make(T value, uint64_t offset) { return {value, offset}; }
+};
+
+inline bool is_separator(char c) { return c == ' ' || c == ',' || (c >= '\t' && c <= '\r'); }
+
+// emits the numbers in the text `read(char *, size_t)` fills blocks with, a
+// batch at a time. `read` returns 0 at the end. a number cut off at the end
+// of a block moves to the front of the next. stops at the first token that
+// isn't a number, as `>>` would. like `>>` it takes a leading `+`, which
+// `from_chars` doesn't.
+template <typename T, typename Read>
+void parse_blocks(Read &&read, size_t block_size, const observer<T> &next, const subscription &sub) {
+    using value_t = typename parsed<T>::type;
+    std::vector<char> block(block_size);
+    std::vector<T> batch;
+    batch.reserve(RX_BATCH_SIZE);
+    size_t carry = 0;
+    uint64_t base = 0; // offset of block[0]
+    bool done = false;
+    while (!done && !sub.is_disposed()) {
+        size_t len = read(block.data() + carry, block.size() - carry);
+        bool last = len == 0;
+        const char *p = block.data();
+        const char *end = p + carry + len;
+        while (true) {
+            while (p < end && is_separator(*p)) {
+                p++;
+            }
+            const char *token = p;
+            while (p < end && !is_separator(*p)) {
+                p++;
+            }
+            if (token == end || (p == end && !last)) {
+                p = token;
+                break;
+            }
+            const char *digits = token;
+            if (*digits == '+' && p - digits > 1 && digits[1] != '-') {
+                digits++;
+            }
+            value_t value;
+            auto result = std::from_chars(digits, p, value);
+            if (result.ec != std::errc() || result.ptr != p) {
+                done = true;
                 break;
             }
-            on_next(value);
+            batch.push_back(parsed<T>::make(value, base + static_cast<uint64_t>(token - block.data())));
+            if (batch.size() == RX_BATCH_SIZE) {
+                emit_batches<T>(next, sub, batch.data(), batch.size());
+                batch.clear();
+                if (sub.is_disposed()) {
+                    done = true;
+                    break;
+                }
+            }
+        }
+        emit_batches<T>(next, sub, batch.data(), batch.size());
+        batch.clear();
+        carry = static_cast<size_t>(end - p);
+        // a token that fills the whole block can't be a number
+        done |= last || carry == block.size();
+        std::memmove(block.data(), p, carry);
+        base += static_cast<uint64_t>(p - block.data());
+    }
+}
+
+} // namespace detail
+
+// the whitespace (or comma) separated numbers in `iss`, read a block at a
+// time and parsed with `std::from_chars`, so neither the locale nor a
+// virtual call per token is involved. `T` is any arithmetic type, or
+// `positioned<T>` for the offsets too. `from_istream<char>` still emits the
+// non-blank characters.
+template <typename T>
+static auto from_istream(std::istream &iss, size_t block_size = 64 * 1024) {
+    return make_observable<T>([&iss, block_size](const observer<T> &next, const subscription &sub) {
+        if constexpr (std::is_same_v<T, char>) {
+            char c;
+            while (sub.acquire() && iss >> c) {
+                next(c);
+            }
+        } else {
+            auto read = [&iss](char *data, size_t size) {
+                iss.read(data, static_cast<std::streamsize>(size));
+                return static_cast<size_t>(iss.gcount());
+            };
+            detail::parse_blocks<T>(read, block_size, next, sub);
+        }
+    });
+}
+
+// the same for the file at `path`, read with plain `read()` calls into
+// blocks of `block_size`, for replaying large captures. a file that can't
+// be opened or read ends the sequence there and disposes `sub`, so a
+// subscriber tells a failure from the end of the file by `is_disposed()`.
+template <typename T>
+static auto from_file(std::string path, size_t block_size = 1024 * 1024) {
+    return make_observable<T>([path, block_size](const observer<T> &next, const subscription &sub) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            sub.dispose();
+            return;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        bool failed = false;
+        auto read_block = [fd, &failed](char *data, size_t size) {
+            ssize_t len;
+            do {
+                len = read(fd, data, size);
+            } while (len < 0 && errno == EINTR);
+            failed = len < 0;
+            return len > 0 ? static_cast<size_t>(len) : 0;
+        };
+        detail::parse_blocks<T>(read_block, block_size, next, sub);
+        close(fd);
+        if (failed) {
+            sub.dispose();
         }
-        throw on_complete();
     });
 }
 
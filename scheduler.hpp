@@ -0,0 +1,401 @@
+#pragma once
+
+#include "refc_ptr.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace rx {
+
+class scheduler;
+
+namespace detail {
+
+// what a blocked thread sleeps on, one per thread. a `wake` before the
+// `wait` isn't lost, the `wait` returns at once; `arm` forgets it.
+class parker {
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    bool _woken = false;
+    scheduler *_interrupt = nullptr;
+
+  public:
+    static parker &local() {
+        static thread_local parker tls_parker;
+        return tls_parker;
+    }
+
+    void arm() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _woken = false;
+    }
+
+    bool woken() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _woken;
+    }
+
+    inline void wake();
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _cv.wait(lock, [this] {
+            return _woken;
+        });
+    }
+
+    // false if the deadline passed first
+    template <typename Clock, typename Duration>
+    bool wait_until(const std::chrono::time_point<Clock, Duration> &deadline) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        return _cv.wait_until(lock, deadline, [this] {
+            return _woken;
+        });
+    }
+
+    // for a scheduler thread that sleeps somewhere else than on the parker
+    // (the run loop, in epoll): `wake` interrupts `sleeper` as well
+    void interrupt(scheduler *sleeper) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _interrupt = sleeper;
+    }
+};
+
+} // namespace detail
+
+// the threads blocked on something, to be woken when it may have changed.
+// a waiter joins before it checks one last time and a notifier looks under
+// the same lock after changing things, so no wakeup falls in between.
+class wait_list {
+    std::mutex _mtx;
+    std::vector<detail::parker *> _parked;
+
+  public:
+    void add(detail::parker *parked) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _parked.push_back(parked);
+    }
+
+    void remove(detail::parker *parked) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto it = std::find(_parked.begin(), _parked.end(), parked);
+        if (it != _parked.end()) {
+            _parked.erase(it);
+        }
+    }
+
+    void notify_all() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        for (auto *parked : _parked) {
+            parked->wake();
+        }
+    }
+};
+
+class scheduler {
+  public:
+    using action_t = std::function<void()>;
+
+    virtual ~scheduler() {}
+
+    virtual void schedule(action_t action) = 0;
+
+    // run one queued action on the calling thread, if this thread belongs to
+    // the scheduler. used by `completion::wait` so a worker that blocks on
+    // a nested subscription keeps draining work instead of deadlocking.
+    virtual bool run_one() { return false; }
+
+    // blocks one of this scheduler's threads, which found nothing to
+    // `run_one`, until `me` is woken or work comes in for it. the caller
+    // checks again either way.
+    virtual void park(detail::parker &me) { me.wait(); }
+
+    // wakes this scheduler's thread from wherever `park` put it to sleep,
+    // if that isn't the parker
+    virtual void interrupt() {}
+
+    static scheduler *&current() {
+        static thread_local scheduler *tls_current = nullptr;
+        return tls_current;
+    }
+};
+
+inline void detail::parker::wake() {
+    scheduler *sleeper;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _woken = true;
+        sleeper = _interrupt;
+    }
+    _cv.notify_one();
+    if (sleeper != nullptr) {
+        sleeper->interrupt();
+    }
+}
+
+using scheduler_ptr = refc_ptr<scheduler>;
+
+// waits until `pred` holds. a scheduler thread runs the scheduler's work in
+// the meantime, the work that would make `pred` true may be queued behind
+// it. `pred` is checked under `lock`, which is let go while waiting, and
+// whatever changes it has to notify `on`, or `also`.
+template <typename Lock, typename Pred>
+void wait_until(wait_list &on, Lock &lock, Pred pred, wait_list *also = nullptr) {
+    auto *self = scheduler::current();
+    auto &me = detail::parker::local();
+    while (!pred()) {
+        lock.unlock();
+        if (self == nullptr || !self->run_one()) {
+            me.arm();
+            on.add(&me);
+            if (also != nullptr) {
+                also->add(&me);
+            }
+            lock.lock();
+            bool ready = pred();
+            lock.unlock();
+            if (!ready) {
+                if (self != nullptr) {
+                    self->park(me);
+                } else {
+                    me.wait();
+                }
+            }
+            on.remove(&me);
+            if (also != nullptr) {
+                also->remove(&me);
+            }
+        }
+        lock.lock();
+    }
+}
+
+// counts outstanding work and lets a thread block until all of it is done
+class completion {
+    std::mutex _mtx;
+    wait_list _waiters;
+    size_t _pending = 0;
+
+  public:
+    void add(size_t n = 1) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _pending += n;
+    }
+
+    void done() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (--_pending == 0) {
+            _waiters.notify_all();
+        }
+    }
+
+    bool is_done() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _pending == 0;
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        wait_until(_waiters, lock, [this] {
+            return _pending == 0;
+        });
+    }
+};
+
+// runs every action inline on the calling thread
+class immediate_scheduler : public scheduler {
+  public:
+    void schedule(action_t action) override { action(); }
+};
+
+// trampoline: the outermost `schedule` on a thread runs the action and then
+// drains whatever it scheduled recursively, so deep chains don't grow the stack
+class current_thread_scheduler : public scheduler {
+    static std::queue<action_t> *&queue() {
+        static thread_local std::queue<action_t> *tls_queue = nullptr;
+        return tls_queue;
+    }
+
+  public:
+    void schedule(action_t action) override {
+        if (queue() != nullptr) {
+            queue()->push(trace::traced(std::move(action), "hop", "current_thread"));
+            return;
+        }
+        std::queue<action_t> pending;
+        auto *outer = scheduler::current();
+        queue() = &pending;
+        scheduler::current() = this;
+        action();
+        while (run_one()) {
+        }
+        scheduler::current() = outer;
+        queue() = nullptr;
+    }
+
+    bool run_one() override {
+        auto *pending = queue();
+        if (pending == nullptr || pending->empty()) {
+            return false;
+        }
+        auto next = std::move(pending->front());
+        pending->pop();
+        next();
+        return true;
+    }
+};
+
+// fixed set of workers, each owning a deque. a worker pops its own work
+// LIFO (cache-warm) and steals FIFO from its siblings when it runs dry.
+class thread_pool_scheduler : public scheduler {
+    struct worker_queue {
+        std::mutex mtx;
+        std::deque<action_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> _queues;
+    std::vector<std::thread> _threads;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    wait_list _parked; // workers blocked in a nested wait
+    std::atomic<size_t> _pending = 0;
+    std::atomic<size_t> _next = 0;
+    bool _stop = false;
+
+    static size_t &worker_index() {
+        static thread_local size_t tls_index = 0;
+        return tls_index;
+    }
+
+    bool pop(size_t index, action_t &action) {
+        auto &own = *_queues[index];
+        {
+            std::lock_guard<std::mutex> lock(own.mtx);
+            if (!own.tasks.empty()) {
+                action = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < _queues.size(); i++) {
+            auto &victim = *_queues[(index + i) % _queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            if (!victim.tasks.empty()) {
+                action = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool run_one(size_t index) {
+        action_t action;
+        if (!pop(index, action)) {
+            return false;
+        }
+        _pending.fetch_sub(1);
+        action();
+        return true;
+    }
+
+    void work(size_t index) {
+        scheduler::current() = this;
+        worker_index() = index;
+        trace::name_thread("thread_pool");
+        while (true) {
+            if (run_one(index)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_mtx);
+            _cv.wait(lock, [this] {
+                return _stop || _pending.load() > 0;
+            });
+            if (_stop && _pending.load() == 0) {
+                break;
+            }
+        }
+        scheduler::current() = nullptr;
+    }
+
+  public:
+    explicit thread_pool_scheduler(size_t num_threads = std::thread::hardware_concurrency()) {
+        num_threads = std::max<size_t>(num_threads, 1);
+        for (size_t i = 0; i < num_threads; i++) {
+            _queues.push_back(std::make_unique<worker_queue>());
+        }
+        for (size_t i = 0; i < num_threads; i++) {
+            _threads.emplace_back([this, i] {
+                work(i);
+            });
+        }
+    }
+
+    ~thread_pool_scheduler() override {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto &thread : _threads) {
+            thread.join();
+        }
+    }
+
+    void schedule(action_t action) override {
+        // workers push onto their own deque, everyone else round-robins
+        size_t index = scheduler::current() == this ? worker_index() : _next.fetch_add(1) % _queues.size();
+        _pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(_queues[index]->mtx);
+            _queues[index]->tasks.push_back(trace::traced(std::move(action), "hop", "thread_pool"));
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+        }
+        _cv.notify_one();
+        _parked.notify_all();
+    }
+
+    bool run_one() override { return scheduler::current() == this && run_one(worker_index()); }
+
+    void park(detail::parker &me) override {
+        _parked.add(&me);
+        if (_pending.load() == 0) {
+            me.wait();
+        }
+        _parked.remove(&me);
+    }
+
+    size_t size() const { return _threads.size(); }
+};
+
+namespace schedulers {
+
+inline scheduler_ptr immediate() {
+    static scheduler_ptr instance(new immediate_scheduler());
+    return instance;
+}
+
+inline scheduler_ptr current_thread() {
+    static scheduler_ptr instance(new current_thread_scheduler());
+    return instance;
+}
+
+inline scheduler_ptr thread_pool() {
+    static scheduler_ptr instance(new thread_pool_scheduler());
+    return instance;
+}
+
+} // namespace schedulers
+
+} // namespace rx
@@ -0,0 +1,429 @@
+#pragma once
+
+#include "span.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// x86 gets hand-written SSE4.1 and AVX2 kernels, picked at runtime, so the
+// library still builds for a baseline target. define RX_NO_SIMD to keep to
+// the scalar loops everywhere.
+#if !defined(RX_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RX_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace rx {
+namespace simd {
+
+// what a sum accumulates in: integers widen to 64 bits, floating point to
+// double, so long runs neither overflow nor drift
+template <typename T>
+using sum_t = std::conditional_t<std::is_floating_point_v<T>, double,
+                                 std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>>;
+
+namespace detail {
+
+enum class isa { scalar, sse41, avx2 };
+
+inline isa detect_isa() {
+#ifdef RX_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return isa::avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return isa::sse41;
+    }
+#endif
+    return isa::scalar;
+}
+
+inline isa current_isa() {
+    static const isa value = detect_isa();
+    return value;
+}
+
+template <typename T>
+constexpr bool is_signed_integer_v = std::is_integral_v<T> && std::is_signed_v<T>;
+
+// the element type a hand-written kernel exists for, void if there is none
+template <typename T>
+using kernel_t = std::conditional_t<
+    std::is_same_v<T, float> || std::is_same_v<T, double>, T,
+    std::conditional_t<is_signed_integer_v<T> && sizeof(T) == 4, int32_t,
+                       std::conditional_t<is_signed_integer_v<T> && sizeof(T) == 8, int64_t, void>>>;
+
+// whether `a` should replace `b` as the running min (or max)
+template <bool Max>
+struct better {
+    template <typename T>
+    bool operator()(const T &a, const T &b) const {
+        return Max ? b < a : a < b;
+    }
+};
+
+template <typename T>
+sum_t<T> sum_scalar(const T *data, size_t n) {
+    sum_t<T> acc = 0;
+    for (size_t i = 0; i < n; i++) {
+        acc += data[i];
+    }
+    return acc;
+}
+
+template <typename T, typename Better>
+T pick_scalar(const T *data, size_t n, Better is_better) {
+    T acc = data[0];
+    for (size_t i = 1; i < n; i++) {
+        if (is_better(data[i], acc)) {
+            acc = data[i];
+        }
+    }
+    return acc;
+}
+
+// branch-free, so the compiler can vectorize it for whatever target the
+// caller was compiled for once `pred` is inlined
+template <typename T, typename Pred>
+inline __attribute__((always_inline)) size_t count_if_loop(const T *data, size_t n, Pred &pred) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += pred(data[i]) ? 1 : 0;
+    }
+    return count;
+}
+
+// the same, a block at a time so a failing run still stops early
+template <typename T, typename Pred>
+inline __attribute__((always_inline)) bool all_of_loop(const T *data, size_t n, Pred &pred) {
+    constexpr size_t block = 256;
+    for (size_t i = 0; i < n; i += block) {
+        bool ok = true;
+        for (size_t j = i, end = std::min(n, i + block); j < end; j++) {
+            ok &= static_cast<bool>(pred(data[j]));
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef RX_SIMD_X86
+
+template <typename T, typename Pred>
+__attribute__((target("avx2"))) size_t count_if_avx2(const T *data, size_t n, Pred &pred) {
+    return count_if_loop(data, n, pred);
+}
+
+template <typename T, typename Pred>
+__attribute__((target("avx2"))) bool all_of_avx2(const T *data, size_t n, Pred &pred) {
+    return all_of_loop(data, n, pred);
+}
+
+// lanes are folded through memory, the tail goes through the scalar loop
+
+__attribute__((target("avx2"))) inline int64_t sum_avx2(const int32_t *data, size_t n) {
+    __m256i lo = _mm256_setzero_si256();
+    __m256i hi = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        lo = _mm256_add_epi64(lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        hi = _mm256_add_epi64(hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi64(lo, hi));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(data + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline int64_t sum_avx2(const int64_t *data, size_t n) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 4)));
+    }
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(data + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline double sum_avx2(const float *data, size_t n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm_loadu_ps(data + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm_loadu_ps(data + i + 4)));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(data + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline double sum_avx2(const double *data, size_t n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(data + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(data + i + 4));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(data + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) inline int64_t sum_sse41(const int32_t *data, size_t n) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        lo = _mm_add_epi64(lo, _mm_cvtepi32_epi64(v));
+        hi = _mm_add_epi64(hi, _mm_cvtepi32_epi64(_mm_srli_si128(v, 8)));
+    }
+    alignas(16) int64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), _mm_add_epi64(lo, hi));
+    return lanes[0] + lanes[1] + sum_scalar(data + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) inline int64_t sum_sse41(const int64_t *data, size_t n) {
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_epi64(acc0, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)));
+        acc1 = _mm_add_epi64(acc1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 2)));
+    }
+    alignas(16) int64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + sum_scalar(data + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) inline double sum_sse41(const float *data, size_t n) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(data + i);
+        acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(v));
+        acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+    alignas(16) double lanes[2];
+    _mm_store_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + sum_scalar(data + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) inline double sum_sse41(const double *data, size_t n) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(data + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(data + i + 2));
+    }
+    alignas(16) double lanes[2];
+    _mm_store_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + sum_scalar(data + i, n - i);
+}
+
+// min and max, `Max` picks which. 64-bit integers have no packed min/max
+// before AVX-512 and stay scalar.
+
+template <bool Max>
+__attribute__((target("avx2"))) int32_t pick_avx2(const int32_t *data, size_t n) {
+    __m256i acc = _mm256_set1_epi32(data[0]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        acc = Max ? _mm256_max_epi32(acc, v) : _mm256_min_epi32(acc, v);
+    }
+    alignas(32) int32_t lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+    int32_t result = pick_scalar(lanes, 8, better<Max>());
+    for (; i < n; i++) {
+        if (better<Max>()(data[i], result)) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+template <bool Max>
+__attribute__((target("avx2"))) float pick_avx2(const float *data, size_t n) {
+    __m256 acc = _mm256_set1_ps(data[0]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(data + i);
+        acc = Max ? _mm256_max_ps(acc, v) : _mm256_min_ps(acc, v);
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, acc);
+    float result = pick_scalar(lanes, 8, better<Max>());
+    for (; i < n; i++) {
+        if (better<Max>()(data[i], result)) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+template <bool Max>
+__attribute__((target("avx2"))) double pick_avx2(const double *data, size_t n) {
+    __m256d acc = _mm256_set1_pd(data[0]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd(data + i);
+        acc = Max ? _mm256_max_pd(acc, v) : _mm256_min_pd(acc, v);
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, acc);
+    double result = pick_scalar(lanes, 4, better<Max>());
+    for (; i < n; i++) {
+        if (better<Max>()(data[i], result)) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+template <bool Max>
+__attribute__((target("sse4.1"))) int32_t pick_sse41(const int32_t *data, size_t n) {
+    __m128i acc = _mm_set1_epi32(data[0]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        acc = Max ? _mm_max_epi32(acc, v) : _mm_min_epi32(acc, v);
+    }
+    alignas(16) int32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+    int32_t result = pick_scalar(lanes, 4, better<Max>());
+    for (; i < n; i++) {
+        if (better<Max>()(data[i], result)) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+template <bool Max>
+__attribute__((target("sse4.1"))) float pick_sse41(const float *data, size_t n) {
+    __m128 acc = _mm_set1_ps(data[0]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(data + i);
+        acc = Max ? _mm_max_ps(acc, v) : _mm_min_ps(acc, v);
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, acc);
+    float result = pick_scalar(lanes, 4, better<Max>());
+    for (; i < n; i++) {
+        if (better<Max>()(data[i], result)) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+template <bool Max>
+__attribute__((target("sse4.1"))) double pick_sse41(const double *data, size_t n) {
+    __m128d acc = _mm_set1_pd(data[0]);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d v = _mm_loadu_pd(data + i);
+        acc = Max ? _mm_max_pd(acc, v) : _mm_min_pd(acc, v);
+    }
+    alignas(16) double lanes[2];
+    _mm_store_pd(lanes, acc);
+    double result = pick_scalar(lanes, 2, better<Max>());
+    for (; i < n; i++) {
+        if (better<Max>()(data[i], result)) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+#endif // RX_SIMD_X86
+
+template <bool Max, typename T>
+T pick(span<const T> values) {
+    using K = kernel_t<T>;
+#ifdef RX_SIMD_X86
+    if constexpr (!std::is_void_v<K> && !std::is_same_v<K, int64_t>) {
+        auto *data = reinterpret_cast<const K *>(values.data());
+        switch (current_isa()) {
+        case isa::avx2:
+            return static_cast<T>(pick_avx2<Max>(data, values.size()));
+        case isa::sse41:
+            return static_cast<T>(pick_sse41<Max>(data, values.size()));
+        default:
+            break;
+        }
+    }
+#endif
+    return pick_scalar(values.data(), values.size(), better<Max>());
+}
+
+} // namespace detail
+
+// sum of a run, in the wider `sum_t`. floating point lanes are added in a
+// different order than a sequential loop would, the result may differ in
+// the last bits.
+template <typename T>
+sum_t<T> sum(span<const T> values) {
+    using K = detail::kernel_t<T>;
+#ifdef RX_SIMD_X86
+    if constexpr (!std::is_void_v<K>) {
+        auto *data = reinterpret_cast<const K *>(values.data());
+        switch (detail::current_isa()) {
+        case detail::isa::avx2:
+            return static_cast<sum_t<T>>(detail::sum_avx2(data, values.size()));
+        case detail::isa::sse41:
+            return static_cast<sum_t<T>>(detail::sum_sse41(data, values.size()));
+        default:
+            break;
+        }
+    }
+#endif
+    return detail::sum_scalar(values.data(), values.size());
+}
+
+// smallest and largest element, `values` must not be empty
+template <typename T>
+T min(span<const T> values) {
+    return detail::pick<false>(values);
+}
+
+template <typename T>
+T max(span<const T> values) {
+    return detail::pick<true>(values);
+}
+
+template <typename T, typename Pred>
+size_t count_if(span<const T> values, Pred &pred) {
+#ifdef RX_SIMD_X86
+    if (detail::current_isa() == detail::isa::avx2) {
+        return detail::count_if_avx2(values.data(), values.size(), pred);
+    }
+#endif
+    return detail::count_if_loop(values.data(), values.size(), pred);
+}
+
+template <typename T, typename Pred>
+bool all_of(span<const T> values, Pred &pred) {
+#ifdef RX_SIMD_X86
+    if (detail::current_isa() == detail::isa::avx2) {
+        return detail::all_of_avx2(values.data(), values.size(), pred);
+    }
+#endif
+    return detail::all_of_loop(values.data(), values.size(), pred);
+}
+
+} // namespace simd
+} // namespace rx
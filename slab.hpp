@@ -0,0 +1,104 @@
+#pragma once
+
+#include "refc_ptr.hpp"
+#include "span.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace rx {
+
+// an append-only run of elements that never moves them, so views into it
+// stay valid while more are added. shared by every view that uses it.
+template <typename T>
+class slab {
+    std::vector<T> _values;
+
+  public:
+    explicit slab(size_t capacity) { _values.reserve(capacity); }
+
+    slab(const slab &) = delete;
+    slab &operator=(const slab &) = delete;
+
+    // within the reserved capacity, push_back never reallocates
+    void push_back(const T &value) { _values.push_back(value); }
+
+    const T *data() const { return _values.data(); }
+    size_t size() const { return _values.size(); }
+    size_t capacity() const { return _values.capacity(); }
+    bool full() const { return _values.size() == _values.capacity(); }
+};
+
+// a window of elements in a slab, which it keeps alive. copying one copies
+// no elements, and overlapping windows share theirs.
+template <typename T>
+class slab_view {
+    refc_ptr<slab<T>> _slab;
+    const T *_data = nullptr;
+    size_t _size = 0;
+
+  public:
+    using value_type = T;
+
+    slab_view() = default;
+
+    slab_view(refc_ptr<slab<T>> owner, size_t offset, size_t size)
+        : _slab(std::move(owner))
+        , _data(_slab->data() + offset)
+        , _size(size) {}
+
+    const T *data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    const T *begin() const { return _data; }
+    const T *end() const { return _data + _size; }
+    const T &operator[](size_t i) const { return _data[i]; }
+
+    span<const T> values() const { return {_data, _size}; }
+};
+
+namespace detail {
+
+// where windowing operators keep their elements. once a slab is full the
+// elements later windows still need move to a fresh one, the windows already
+// handed out keep the old one.
+template <typename T>
+class slab_buffer {
+    refc_ptr<slab<T>> _slab;
+    size_t _capacity;
+
+  public:
+    explicit slab_buffer(size_t capacity)
+        : _capacity(std::max<size_t>(capacity, 1)) {}
+
+    // appends `value`, keeping the last `keep` elements in the same slab as
+    // it. returns how many elements from the front were left behind, by
+    // which the indices of the rest went down.
+    size_t push(const T &value, size_t keep) {
+        size_t dropped = 0;
+        if (!_slab) {
+            _slab = make_refc_ptr<slab<T>>(_capacity);
+        } else if (_slab->full()) {
+            size_t kept = std::min(keep, _slab->size());
+            dropped = _slab->size() - kept;
+            // a long tail gets a bigger slab, so it isn't moved on every push
+            auto fresh = make_refc_ptr<slab<T>>(std::max(_capacity, 2 * kept + 1));
+            for (size_t i = dropped; i < _slab->size(); i++) {
+                fresh->push_back(_slab->data()[i]);
+            }
+            _slab = std::move(fresh);
+        }
+        _slab->push_back(value);
+        return dropped;
+    }
+
+    size_t size() const { return _slab ? _slab->size() : 0; }
+
+    // elements [from, to) of the current slab
+    slab_view<T> view(size_t from, size_t to) const { return slab_view<T>(_slab, from, to - from); }
+};
+
+} // namespace detail
+
+} // namespace rx
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+
+namespace rx {
+
+// a pointer and a length, the part of C++20's std::span the batch channel
+// needs
+template <typename T>
+class span {
+    T *_data = nullptr;
+    size_t _size = 0;
+
+  public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+    using iterator = T *;
+
+    constexpr span() = default;
+
+    constexpr span(T *data, size_t size)
+        : _data(data)
+        , _size(size) {}
+
+    template <typename Container,
+              typename = std::enable_if_t<std::is_convertible_v<decltype(std::data(std::declval<Container &>())), T *>>>
+    constexpr span(Container &container)
+        : _data(std::data(container))
+        , _size(std::size(container)) {}
+
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U *, T *>>>
+    constexpr span(const span<U> &other)
+        : _data(other.data())
+        , _size(other.size()) {}
+
+    constexpr T *data() const { return _data; }
+    constexpr size_t size() const { return _size; }
+    constexpr bool empty() const { return _size == 0; }
+
+    constexpr T *begin() const { return _data; }
+    constexpr T *end() const { return _data + _size; }
+
+    constexpr T &operator[](size_t i) const { return _data[i]; }
+    constexpr T &front() const { return _data[0]; }
+    constexpr T &back() const { return _data[_size - 1]; }
+
+    constexpr span first(size_t count) const { return {_data, count}; }
+    constexpr span subspan(size_t offset) const { return {_data + offset, _size - offset}; }
+    constexpr span subspan(size_t offset, size_t count) const { return {_data + offset, count}; }
+};
+
+} // namespace rx
@@ -1,8 +1,14 @@
 #pragma once
 
+#include "epoch.hpp"
+#include "ring_buffer.hpp"
 #include "rx.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <list>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 template <typename T>
@@ -11,9 +17,11 @@ class subject : public rx::observable<T> {
 
   public:
     subject()
-        : rx::observable<T>([this](const rx::observer<T> &obs) {
-            _observables.push_back(obs);
-        }) {}
+        : rx::observable<T>([this](rx::observer<T> &&obs) {
+            _observables.push_back(std::move(obs));
+        }) {
+        this->set_hot(true);
+    }
 
     void on_next(const T &t) {
         for (const auto &next : _observables) {
@@ -33,11 +41,13 @@ class behavior_subject : public rx::observable<T> {
 
   public:
     explicit behavior_subject(const T &t)
-        : _current(t)
-        , rx::observable<T>([this](const rx::observer<T> &obs) {
+        : rx::observable<T>([this](rx::observer<T> &&obs) {
             obs(_current);
-            _lst.push_back(obs);
-        }) {}
+            _lst.push_back(std::move(obs));
+        })
+        , _current(t) {
+        this->set_hot(true);
+    }
     virtual ~behavior_subject() {}
     virtual void on_next(const T &t) {
         _current = t;
@@ -49,28 +59,171 @@ class behavior_subject : public rx::observable<T> {
 
 template <typename T>
 class replay_subject : public rx::observable<T> {
-    size_t _len;
-    std::list<T> _q;
+    rx::ring_buffer<T> _q;
     std::vector<rx::observer<T>> _lst;
 
   public:
+    // the history goes out to a late subscriber in a batch per contiguous run
+    // of the ring, as far as its demand allows
     replay_subject(size_t buf_len)
-        : rx::observable<T>([this](const rx::observer<T> &obs) {
-            for (auto &item : _q) {
-                obs(item);
-            }
-            _lst.push_back(obs);
+        : rx::observable<T>([this](rx::observer<T> &&obs, const rx::subscription &sub) {
+            _q.for_each_run([&obs, &sub](const T *data, size_t count) {
+                rx::detail::emit_batches<T>(obs, sub, data, count);
+            });
+            _lst.push_back(std::move(obs));
         })
-        , _len(buf_len) {}
+        , _q(buf_len) {
+        this->set_hot(true);
+    }
     virtual ~replay_subject() {}
 
     virtual void on_next(const T &t) {
         _q.push_back(t);
-        if (_q.size() > _len) {
-            _q.pop_front();
+        for (auto &next : _lst) {
+            next(t);
         }
+    }
+};
+
+// replays whatever arrived within the last `window`, but no more than the
+// last `capacity` elements. the history grows by doubling while the rate goes
+// up and is otherwise reused in place. times and values are kept in rings of
+// their own that move in step, so the values replay in batches as above.
+template <typename T>
+class timed_replay_subject : public rx::observable<T> {
+    using clock_t = std::chrono::steady_clock;
+
+    clock_t::duration _window;
+    size_t _capacity;
+    rx::ring_buffer<clock_t::time_point> _stamps;
+    rx::ring_buffer<T> _values;
+    std::vector<rx::observer<T>> _lst;
+
+    void expire(clock_t::time_point now) {
+        while (!_stamps.empty() && now - _stamps.front() > _window) {
+            _stamps.pop_front();
+            _values.pop_front();
+        }
+    }
+
+  public:
+    template <typename Duration>
+    explicit timed_replay_subject(const Duration &window, size_t capacity = 4096)
+        : rx::observable<T>([this](rx::observer<T> &&obs, const rx::subscription &sub) {
+            expire(clock_t::now());
+            _values.for_each_run([&obs, &sub](const T *data, size_t count) {
+                rx::detail::emit_batches<T>(obs, sub, data, count);
+            });
+            _lst.push_back(std::move(obs));
+        })
+        , _window(std::chrono::duration_cast<clock_t::duration>(window))
+        , _capacity(std::max<size_t>(capacity, 1))
+        , _stamps(std::min<size_t>(_capacity, 64))
+        , _values(std::min<size_t>(_capacity, 64)) {
+        this->set_hot(true);
+    }
+    virtual ~timed_replay_subject() {}
+
+    virtual void on_next(const T &t) {
+        auto now = clock_t::now();
+        expire(now);
+        // once at `_capacity`, a push overwrites the oldest in both
+        if (_values.full() && _values.capacity() < _capacity) {
+            size_t larger = std::min(_values.capacity() * 2, _capacity);
+            _stamps.reserve(larger);
+            _values.reserve(larger);
+        }
+        _stamps.push_back(now);
+        _values.push_back(t);
         for (auto &next : _lst) {
             next(t);
         }
     }
 };
+
+// a subject that any number of threads may subscribe to, unsubscribe from (by
+// disposing the subscription) and push into at the same time. `on_next` walks
+// an immutable snapshot of the subscribers under an epoch pin and never
+// locks; subscribing and unsubscribing copy the list, publish the copy and
+// retire the old one. with several producers an observer may be called from
+// several threads at once.
+template <typename T>
+class concurrent_subject : public rx::observable<T> {
+    struct node_t {
+        rx::observer<T> obs;
+        std::atomic<bool> active{true};
+    };
+    using snapshot_t = std::vector<refc_ptr<node_t>>;
+
+    // outlives the subject for as long as subscriptions can still unsubscribe
+    struct core_t {
+        std::mutex mtx; // writers only
+        std::atomic<snapshot_t *> snapshot{new snapshot_t()};
+        bool completed = false;
+
+        ~core_t() { delete snapshot.load(); }
+
+        void publish(snapshot_t *next) { rx::epoch_domain::instance().retire(snapshot.exchange(next)); }
+
+        bool add(const refc_ptr<node_t> &node) {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (completed) {
+                return false;
+            }
+            auto *next = new snapshot_t(*snapshot.load());
+            next->push_back(node);
+            publish(next);
+            return true;
+        }
+
+        void remove(node_t *node) {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto *next = new snapshot_t();
+            for (const auto &entry : *snapshot.load()) {
+                if (entry.get() != node) {
+                    next->push_back(entry);
+                }
+            }
+            publish(next);
+        }
+
+        void complete() {
+            std::lock_guard<std::mutex> lock(mtx);
+            completed = true;
+            publish(new snapshot_t());
+        }
+    };
+
+    refc_ptr<core_t> _core;
+
+  public:
+    concurrent_subject()
+        : rx::observable<T>([this](rx::observer<T> &&obs, const rx::subscription &sub) {
+            auto node = make_refc_ptr<node_t>();
+            node->obs = std::move(obs);
+            if (!_core->add(node)) {
+                return;
+            }
+            // may run right away, if `sub` is already disposed
+            sub.add([core = _core, node] {
+                node->active.store(false, std::memory_order_relaxed);
+                core->remove(node.get());
+            });
+        })
+        , _core(make_refc_ptr<core_t>()) {
+        this->set_hot(true);
+    }
+
+    void on_next(const T &t) {
+        auto pin = rx::epoch_domain::instance().pin();
+        for (const auto &node : *_core->snapshot.load()) {
+            // skip subscribers that unsubscribed after this snapshot was taken
+            if (node->active.load(std::memory_order_relaxed)) {
+                node->obs(t);
+            }
+        }
+    }
+
+    // drops every subscriber, later subscriptions get nothing
+    void on_completed() { _core->complete(); }
+};
@@ -0,0 +1,385 @@
+#pragma once
+
+#include "inplace_function.hpp"
+#include "refc_ptr.hpp"
+#include "scheduler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace rx {
+
+// handle to a running subscription, returned by `observable::subscribe` and
+// handed to every subscribe callback. sources poll `is_disposed()` (a single
+// atomic load) and stop early; `dispose()` may be called from any thread and
+// runs the registered teardowns, e.g. to unblock a source sitting in a system
+// call. copies share the same state.
+//
+// it also carries the downstream demand. sources call `acquire()` before
+// every element, which for the default unbounded demand is the same single
+// load. a subscription created `with_demand(n)` lets them emit `n` elements
+// and then blocks them until the consumer calls `request(k)` for more.
+class subscription {
+  public:
+    using teardown_t = inplace_function<void()>;
+
+    static constexpr long unbounded = LONG_MAX;
+
+  private:
+    // counted intrusively, so a handle is a single pointer that can be set
+    // atomically the first time it is needed
+    struct state_t : refc_block<refc_atomic> {
+        std::atomic<bool> disposed = false;
+        std::recursive_mutex mtx;
+        wait_list waiters; // woken on dispose and on request
+        std::vector<std::pair<uint64_t, teardown_t>> teardowns;
+        uint64_t next_id = 1;
+        // set for children, so they can unregister from the parent
+        refc_ptr<state_t> parent;
+        uint64_t parent_id = 0;
+        // children share their parent's demand unless they got their own
+        bool own_demand = true;
+        std::atomic<long> requested = unbounded;
+        teardown_t on_request;
+
+        state_t *demand_owner() {
+            auto *state = this;
+            while (!state->own_demand) {
+                state = state->parent.get();
+            }
+            return state;
+        }
+
+        // false if the demand is unbounded and there is nothing to record
+        bool add_demand(long n) {
+            long current = requested.load(std::memory_order_relaxed);
+            while (current != unbounded) {
+                long next = n >= unbounded - current ? unbounded : current + n;
+                if (requested.compare_exchange_weak(current, next, std::memory_order_release)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        ~state_t() {
+            if (parent) {
+                parent->remove(parent_id);
+            }
+        }
+
+        uint64_t add(teardown_t &&teardown) {
+            {
+                std::lock_guard<std::recursive_mutex> lock(mtx);
+                if (!disposed.load(std::memory_order_relaxed)) {
+                    teardowns.emplace_back(next_id, std::move(teardown));
+                    return next_id++;
+                }
+            }
+            teardown();
+            return 0;
+        }
+
+        void remove(uint64_t id) {
+            std::lock_guard<std::recursive_mutex> lock(mtx);
+            auto it = std::find_if(teardowns.begin(), teardowns.end(), [id](const auto &entry) {
+                return entry.first == id;
+            });
+            if (it != teardowns.end()) {
+                teardowns.erase(it);
+            }
+        }
+
+        void close() {
+            // teardowns run under the lock, so a child can't be destroyed
+            // while its parent is still disposing it, and a second dispose
+            // returns only once they are done. they may unregister other
+            // children on the way, hence the recursive mutex.
+            std::lock_guard<std::recursive_mutex> lock(mtx);
+            if (disposed.exchange(true)) {
+                return;
+            }
+            while (!teardowns.empty()) {
+                auto teardown = std::move(teardowns.back().second);
+                teardowns.pop_back();
+                teardown();
+            }
+            waiters.notify_all();
+        }
+    };
+
+    // made on first use. a cold chain hands its subscription down by
+    // reference, and one nobody copies, disposes or bounds never needs any:
+    // until then it reads as not disposed, with unbounded demand. every
+    // handle holds one reference.
+    mutable std::atomic<state_t *> _state{nullptr};
+
+    state_t *peek() const { return _state.load(std::memory_order_acquire); }
+
+    state_t *state() const {
+        auto *current = peek();
+        if (current == nullptr) {
+            auto *made = new state_t();
+            made->count = 1;
+            if (_state.compare_exchange_strong(current, made, std::memory_order_acq_rel)) {
+                return made;
+            }
+            delete made;
+        }
+        return current;
+    }
+
+    static state_t *retain(state_t *state) {
+        refc_atomic::increment(state->count);
+        return state;
+    }
+
+    static void release(state_t *state) {
+        if (state != nullptr && refc_atomic::decrement(state->count)) {
+            delete state;
+        }
+    }
+
+    subscription child_of(bool own_demand, long demand) const {
+        subscription sub;
+        auto *child = sub.state();
+        auto *parent = state();
+        child->own_demand = own_demand;
+        child->requested = demand;
+        child->parent = refc_ptr<state_t>(parent);
+        child->parent_id = parent->add([child] {
+            child->close();
+        });
+        return sub;
+    }
+
+  public:
+    subscription() = default;
+
+    // noexcept, like a move: callbacks capture a `const subscription &` by
+    // copy, and only a callback that moves without throwing fits inline in
+    // an `inplace_function`
+    subscription(const subscription &other) noexcept
+        : _state(retain(other.state())) {}
+
+    subscription(subscription &&other) noexcept
+        : _state(other._state.exchange(nullptr)) {}
+
+    subscription &operator=(const subscription &other) {
+        release(_state.exchange(retain(other.state())));
+        return *this;
+    }
+
+    subscription &operator=(subscription &&other) noexcept {
+        if (this != &other) {
+            release(_state.exchange(other._state.exchange(nullptr)));
+        }
+        return *this;
+    }
+
+    ~subscription() { release(peek()); }
+
+    // a subscription whose sources may emit `n` elements before the consumer
+    // has to `request` more
+    static subscription with_demand(long n) {
+        subscription sub;
+        sub.state()->requested = n;
+        return sub;
+    }
+
+    bool is_disposed() const {
+        auto *state = peek();
+        return state != nullptr && state->disposed.load(std::memory_order_acquire);
+    }
+
+    void dispose() const { state()->close(); }
+
+    // runs `teardown` on dispose, or right away if already disposed
+    void add(teardown_t teardown) const { state()->add(std::move(teardown)); }
+
+    // a subscription that is disposed along with this one, but can also be
+    // disposed on its own. operators that stop their upstream early (take,
+    // first, all) use one so the downstream keeps running.
+    subscription child() const { return child_of(false, 0); }
+
+    // same, but with its own demand of `n`. operators that buffer (observe_on)
+    // use one to bound what their upstream may push ahead.
+    subscription child(long n) const { return child_of(true, n); }
+
+    // for operators that don't emit one for one (reduce, buffers, flat_map's
+    // outer sequence), whose upstream can't be held to the downstream demand.
+    // this subscription if it is unbounded anyway.
+    subscription unbounded_child() const {
+        auto *state = peek();
+        if (state == nullptr || state->demand_owner()->requested.load(std::memory_order_relaxed) == unbounded) {
+            return *this;
+        }
+        return child(unbounded);
+    }
+
+    // allow `n` more elements. wakes sources waiting in `acquire()` and runs
+    // the `on_request` hook, if one is set
+    void request(long n) const {
+        auto *state = peek();
+        if (n <= 0 || state == nullptr) {
+            return;
+        }
+        auto *owner = state->demand_owner();
+        if (!owner->add_demand(n)) {
+            return;
+        }
+        teardown_t hook;
+        {
+            std::lock_guard<std::recursive_mutex> lock(owner->mtx);
+            hook = owner->on_request;
+        }
+        owner->waiters.notify_all();
+        if (hook) {
+            hook();
+        }
+    }
+
+    // called after every `request`, lets an operator that holds elements
+    // back hand them out. one hook per demand, pass nullptr to clear it.
+    void on_request(teardown_t hook) const {
+        auto *owner = state()->demand_owner();
+        std::lock_guard<std::recursive_mutex> lock(owner->mtx);
+        owner->on_request = std::move(hook);
+    }
+
+    // takes one element of demand if there is any. false if there is none
+    // or the subscription is disposed.
+    bool try_acquire() const {
+        if (is_disposed()) {
+            return false;
+        }
+        auto *state = peek();
+        if (state == nullptr) {
+            return true;
+        }
+        auto &requested = state->demand_owner()->requested;
+        long current = requested.load(std::memory_order_acquire);
+        while (current != unbounded) {
+            if (current == 0) {
+                return false;
+            }
+            if (requested.compare_exchange_weak(current, current - 1, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return true;
+    }
+
+    // blocks until there is demand, without taking it. false once disposed.
+    // like `completion::wait`, a scheduler thread keeps running work while it
+    // waits, the consumer that will request more may be queued behind it.
+    bool wait_demand() const {
+        auto *state = peek();
+        if (state == nullptr) {
+            return true;
+        }
+        auto *owner = state->demand_owner();
+        return wait_until(owner->waiters, [owner] {
+            return owner->requested.load(std::memory_order_acquire) != 0;
+        });
+    }
+
+    // what sources call before every element: waits for demand and takes
+    // one. false once disposed. for an unbounded subscription this is just
+    // the disposed check.
+    bool acquire() const {
+        auto *state = peek();
+        if (state == nullptr || state->demand_owner()->requested.load(std::memory_order_relaxed) == unbounded) {
+            return !is_disposed();
+        }
+        while (wait_demand()) {
+            if (try_acquire()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the same for a run of up to `n` elements: waits for some demand and
+    // takes as much of it as it can. 0 once disposed.
+    size_t acquire(size_t n) const {
+        auto *state = peek();
+        if (state == nullptr) {
+            return n;
+        }
+        auto &requested = state->demand_owner()->requested;
+        if (requested.load(std::memory_order_relaxed) == unbounded) {
+            return is_disposed() ? 0 : n;
+        }
+        while (wait_demand()) {
+            long current = requested.load(std::memory_order_acquire);
+            while (current > 0) {
+                if (current == unbounded) {
+                    return n;
+                }
+                long taken = std::min<long>(current, static_cast<long>(n));
+                if (requested.compare_exchange_weak(current, current - taken, std::memory_order_acquire)) {
+                    return static_cast<size_t>(taken);
+                }
+            }
+        }
+        return 0;
+    }
+
+    // blocks until disposed, and until the teardowns have run. sources
+    // driven from another thread (the run loop) park their subscriber here.
+    void wait() const {
+        auto *state = this->state();
+        wait_until(state->waiters, [] {
+            return false;
+        });
+        // dispose runs the teardowns under the lock
+        std::lock_guard<std::recursive_mutex> lock(state->mtx);
+    }
+
+    // `rx::wait_until` on `on`, that also gives up once this subscription
+    // is disposed. false then.
+    template <typename Lock, typename Pred>
+    bool wait_until(wait_list &on, Lock &lock, Pred pred) const {
+        rx::wait_until(
+            on, lock,
+            [this, &pred] {
+                return is_disposed() || pred();
+            },
+            &state()->waiters);
+        return !is_disposed();
+    }
+
+    // the same for a `pred` that needs no lock
+    template <typename Pred>
+    bool wait_until(wait_list &on, Pred pred) const {
+        struct {
+            void lock() {}
+            void unlock() {}
+        } unlocked;
+        return wait_until(on, unlocked, std::move(pred));
+    }
+
+    // sleeps for `duration` or until disposed. returns false once disposed.
+    template <typename Duration>
+    bool wait_for(const Duration &duration) const {
+        auto deadline = std::chrono::steady_clock::now() + duration;
+        auto &me = detail::parker::local();
+        auto &waiters = state()->waiters;
+        bool woken = true;
+        while (woken && !is_disposed()) {
+            me.arm();
+            waiters.add(&me);
+            woken = is_disposed() || me.wait_until(deadline);
+            waiters.remove(&me);
+        }
+        return !is_disposed();
+    }
+};
+
+} // namespace rx
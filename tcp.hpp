@@ -0,0 +1,159 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "run_loop.hpp"
+#include "rx.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace rx {
+
+// a chunk read from one of the connections of a `tcp_listen` source. the
+// bytes stay valid for as long as the chunk (or a copy) is kept. an empty
+// chunk marks the end of its connection.
+struct tcp_chunk {
+    uint64_t connection;
+    buffer_slice slice;
+
+    std::string_view bytes() const { return slice.bytes; }
+    bool closed() const { return slice.empty(); }
+};
+
+namespace detail {
+
+// reads go into the unused tail of the current block until less than this
+// is left, then a fresh block is taken from the pool
+constexpr size_t tcp_min_read = 4 * 1024;
+
+inline int tcp_bind(uint16_t port, int backlog) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    int option = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(sock, backlog) < 0) {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+} // namespace detail
+
+// accepts any number of connections on `port` and emits what they send, as
+// slices of blocks from `pool`, tagged with a connection id. the sockets are
+// watched by the run loop and chunks are emitted on its thread, the
+// subscribing thread only waits. without demand a connection is not read,
+// which throttles its peer through tcp flow control, until `request` resumes
+// it. runs until the subscription is disposed.
+inline auto tcp_listen(uint16_t port, refc_ptr<buffer_pool> pool = make_refc_ptr<buffer_pool>(),
+                       int backlog = SOMAXCONN) {
+    return make_observable<tcp_chunk>([port, pool, backlog](const observer<tcp_chunk> &on_next,
+                                                            const subscription &sub) {
+        int sock = detail::tcp_bind(port, backlog);
+        if (sock < 0) {
+            return;
+        }
+        struct state_t {
+            std::recursive_mutex mtx;
+            bool stopped = false;
+            std::unordered_map<int, uint64_t> connections;
+            std::vector<int> paused;
+            uint64_t next_id = 1;
+            buffer_pool::buffer current;
+            size_t used = 0;
+        };
+        auto state = make_refc_ptr<state_t>();
+        auto &loop = run_loop::instance();
+        // a child, so the teardown is gone before the descriptors close
+        auto listening = sub.child();
+
+        auto reader = [state, pool, listening, &on_next, &loop](int fd) {
+            return [state, pool, listening, &on_next, &loop, fd](uint32_t) {
+                std::lock_guard<std::recursive_mutex> lock(state->mtx);
+                if (state->stopped) {
+                    return;
+                }
+                if (!listening.try_acquire()) {
+                    loop.modify(fd, 0);
+                    state->paused.push_back(fd);
+                    return;
+                }
+                if (!state->current || state->current->capacity() - state->used < detail::tcp_min_read) {
+                    state->current = pool->acquire();
+                    state->used = 0;
+                }
+                auto &current = state->current;
+                ssize_t len = read(fd, current->data() + state->used, current->capacity() - state->used);
+                if (len > 0) {
+                    std::string_view bytes(current->data() + state->used, static_cast<size_t>(len));
+                    state->used += static_cast<size_t>(len);
+                    on_next(tcp_chunk{state->connections[fd], {current, bytes}});
+                    return;
+                }
+                if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+                    // nothing was emitted, hand the element back
+                    listening.request(1);
+                    return;
+                }
+                auto id = state->connections[fd];
+                loop.unwatch(fd);
+                close(fd);
+                state->connections.erase(fd);
+                on_next(tcp_chunk{id, {}});
+            };
+        };
+
+        listening.on_request([state, &loop] {
+            std::lock_guard<std::recursive_mutex> lock(state->mtx);
+            for (int fd : state->paused) {
+                loop.modify(fd, EPOLLIN);
+            }
+            state->paused.clear();
+        });
+        listening.add([state, sock, &loop] {
+            std::lock_guard<std::recursive_mutex> lock(state->mtx);
+            state->stopped = true;
+            loop.unwatch(sock);
+            for (const auto &connection : state->connections) {
+                loop.unwatch(connection.first);
+            }
+        });
+        loop.watch(sock, EPOLLIN, [state, sock, reader, &loop](uint32_t) {
+            std::lock_guard<std::recursive_mutex> lock(state->mtx);
+            if (state->stopped) {
+                return;
+            }
+            int client;
+            while ((client = accept4(sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                state->connections.emplace(client, state->next_id++);
+                loop.watch(client, EPOLLIN, reader(client));
+            }
+        });
+
+        listening.wait();
+        listening.on_request(nullptr);
+        for (const auto &connection : state->connections) {
+            close(connection.first);
+        }
+        close(sock);
+    });
+}
+
+} // namespace rx
@@ -0,0 +1,263 @@
+#pragma once
+
+#include "refc_ptr.hpp"
+#include "scheduler.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace rx {
+
+// hierarchical timing wheel (Varghese & Lauck) driven by a single thread.
+// level 0 holds the next 64 ticks one slot per tick, each higher level covers
+// 64x the span of the one below and is cascaded down as time reaches it, so
+// inserting a timer is O(1) no matter how far out it is. actions run on the
+// wheel thread, one at a time, in deadline order.
+class timer_wheel : public scheduler {
+  public:
+    using clock_t = std::chrono::steady_clock;
+    using tick_t = uint64_t;
+
+    static constexpr size_t bits = 6;
+    static constexpr size_t slots = 1 << bits;
+    static constexpr size_t levels = 4;
+
+  private:
+    struct entry {
+        tick_t deadline;
+        uint64_t seq;
+        action_t action;
+    };
+
+    clock_t::duration _resolution;
+    clock_t::time_point _epoch;
+    tick_t _current = 0;
+    tick_t _wake = std::numeric_limits<tick_t>::max();
+    uint64_t _seq = 0;
+    size_t _size = 0;
+    std::array<std::array<std::vector<entry>, slots>, levels> _wheel;
+    std::deque<action_t> _due;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    wait_list _parked; // the wheel thread, blocked in a nested wait
+    bool _stop = false;
+    std::thread _thread;
+
+    tick_t now_tick() const { return static_cast<tick_t>((clock_t::now() - _epoch) / _resolution); }
+
+    tick_t to_tick(clock_t::time_point when) const {
+        if (when <= _epoch) {
+            return 0;
+        }
+        // round up, a timer never fires early
+        return static_cast<tick_t>((when - _epoch + _resolution - clock_t::duration(1)) / _resolution);
+    }
+
+    void insert(entry &&e) {
+        if (e.deadline <= _current) {
+            _due.push_back(std::move(e.action));
+            return;
+        }
+        tick_t delta = e.deadline - _current;
+        for (size_t level = 0; level < levels; level++) {
+            if (level == levels - 1 || delta < (tick_t(1) << (bits * (level + 1)))) {
+                auto slot = (e.deadline >> (bits * level)) & (slots - 1);
+                _wheel[level][slot].push_back(std::move(e));
+                _size++;
+                return;
+            }
+        }
+    }
+
+    void cascade(size_t level, size_t slot) {
+        std::vector<entry> entries;
+        entries.swap(_wheel[level][slot]);
+        _size -= entries.size();
+        for (auto &e : entries) {
+            insert(std::move(e));
+        }
+    }
+
+    void advance(tick_t target) {
+        if (_size == 0) {
+            _current = std::max(_current, target);
+            return;
+        }
+        while (_current < target) {
+            _current++;
+            for (size_t level = 1; level < levels; level++) {
+                if (((_current >> (bits * (level - 1))) & (slots - 1)) != 0) {
+                    break;
+                }
+                cascade(level, (_current >> (bits * level)) & (slots - 1));
+            }
+            auto &slot = _wheel[0][_current & (slots - 1)];
+            if (slot.empty()) {
+                continue;
+            }
+            // timers for one tick may have reached this slot by different
+            // routes; keep them in the order they were scheduled
+            std::sort(slot.begin(), slot.end(), [](const entry &a, const entry &b) {
+                return a.seq < b.seq;
+            });
+            for (auto &e : slot) {
+                _due.push_back(std::move(e.action));
+            }
+            _size -= slot.size();
+            slot.clear();
+        }
+    }
+
+    // next tick that has work: a non-empty level 0 slot, or the next cascade
+    tick_t next_wake() const {
+        tick_t tick = _current + 1;
+        while ((tick & (slots - 1)) != 0 && _wheel[0][tick & (slots - 1)].empty()) {
+            tick++;
+        }
+        return tick;
+    }
+
+    void run() {
+        scheduler::current() = this;
+        trace::name_thread("timer_wheel");
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (!_stop) {
+            advance(now_tick());
+            if (!_due.empty()) {
+                auto action = std::move(_due.front());
+                _due.pop_front();
+                lock.unlock();
+                action();
+                lock.lock();
+                continue;
+            }
+            if (_size == 0) {
+                _wake = std::numeric_limits<tick_t>::max();
+                _cv.wait(lock);
+            } else {
+                _wake = next_wake();
+                _cv.wait_until(lock, _epoch + _resolution * _wake);
+            }
+        }
+        scheduler::current() = nullptr;
+    }
+
+  public:
+    explicit timer_wheel(clock_t::duration resolution = std::chrono::milliseconds(1))
+        : _resolution(resolution)
+        , _epoch(clock_t::now()) {
+        _thread = std::thread([this] {
+            run();
+        });
+    }
+
+    ~timer_wheel() override {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    static timer_wheel &instance() {
+        static refc_ptr<timer_wheel> wheel(new timer_wheel());
+        return *wheel;
+    }
+
+    void schedule(action_t action) override {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _due.push_back(trace::traced(std::move(action), "hop", "timer_wheel"));
+        }
+        _cv.notify_one();
+        _parked.notify_all();
+    }
+
+    void schedule_at(clock_t::time_point when, action_t action) {
+        bool wake = false;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto deadline = to_tick(when);
+            insert(entry{deadline, _seq++, trace::traced(std::move(action), "timer", "timer_wheel")});
+            // only poke the wheel thread if it would otherwise oversleep
+            wake = deadline < _wake;
+        }
+        if (wake) {
+            _cv.notify_one();
+            _parked.notify_all();
+        }
+    }
+
+    template <typename Duration>
+    void schedule_after(const Duration &delay, action_t action) {
+        schedule_at(clock_t::now() + std::chrono::duration_cast<clock_t::duration>(delay), std::move(action));
+    }
+
+    // `fun` returns the next deadline to re-arm at, or nullopt to stop
+    template <typename Fun>
+    void schedule_recurring(clock_t::time_point when, Fun fun) {
+        schedule_at(when, [this, fun]() mutable {
+            if (std::optional<clock_t::time_point> next = fun()) {
+                schedule_recurring(*next, std::move(fun));
+            }
+        });
+    }
+
+    // fire whatever is due; lets a wheel-thread action that blocks on a
+    // completion keep the wheel turning
+    bool run_one() override {
+        if (scheduler::current() != this) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(_mtx);
+        advance(now_tick());
+        if (_due.empty()) {
+            return false;
+        }
+        auto action = std::move(_due.front());
+        _due.pop_front();
+        lock.unlock();
+        action();
+        return true;
+    }
+
+    // sleeps until `me` is woken or the next timer is due
+    void park(detail::parker &me) override {
+        _parked.add(&me);
+        std::optional<clock_t::time_point> until;
+        bool due;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            advance(now_tick());
+            due = !_due.empty();
+            _wake = _size == 0 ? std::numeric_limits<tick_t>::max() : next_wake();
+            if (_size != 0) {
+                until = _epoch + _resolution * _wake;
+            }
+        }
+        if (!due) {
+            if (until) {
+                me.wait_until(*until);
+            } else {
+                me.wait();
+            }
+        }
+        _parked.remove(&me);
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _size + _due.size();
+    }
+};
+
+} // namespace rx
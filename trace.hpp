@@ -0,0 +1,342 @@
+#pragma once
+
+// a timeline of running chains, for chrome://tracing or ui.perfetto.dev.
+// opt-in like the metrics: define RX_TRACE (which brings RX_METRICS with it)
+// and record for a while:
+//
+//     rx::trace::tracer::instance().start();
+//     ...
+//     rx::trace::tracer::instance().write("/tmp/rx.trace.json");
+//
+// a subscription is a span named after its stage (category `subscribe`),
+// an element or batch handed to a stage's callback one named after that
+// stage (`next`), and an action a scheduler runs for a stage, a hop to a
+// worker or a timer firing, one named after the stage that scheduled it
+// (`hop`, `timer`, `io`). so a `delay` that holds up a `flat_map` shows as
+// its timer spans on the timer thread next to the gaps in the pool's.
+//
+// every thread records into a buffer of its own, without locks. buffers
+// grow up to the limit given to `start`; spans past it are dropped and
+// counted. each `start` empties them again, as their threads record next.
+
+#if defined(RX_TRACE) && !defined(RX_METRICS)
+#define RX_METRICS
+#endif
+
+#include "dump.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace rx {
+
+namespace trace {
+
+struct event {
+    const char *name;
+    const char *category;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint64_t count; // elements, for `next`
+};
+
+namespace detail {
+
+inline uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+// the name of the innermost span open on this thread, which is what an
+// action scheduled from here is attributed to
+inline const char *&current() {
+    static thread_local const char *tls_current = nullptr;
+    return tls_current;
+}
+
+// the spans of one thread, in chunks that never move, so they can be read
+// while the thread adds more. only the owning thread writes.
+class thread_buffer {
+  public:
+    static constexpr size_t chunk_size = 4096;
+
+  private:
+    struct chunk {
+        event events[chunk_size];
+        std::atomic<size_t> used{0};
+        std::atomic<chunk *> next{nullptr};
+    };
+
+    chunk *_head;
+    chunk *_tail;
+    size_t _chunks = 1;
+
+    // from malloc, so the buffers don't count against the running stage's
+    // allocations
+    static chunk *make_chunk() {
+        void *memory = std::malloc(sizeof(chunk));
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return new (memory) chunk();
+    }
+
+  public:
+    const uint32_t tid;
+    std::string thread_name; // under the tracer's lock
+    std::atomic<uint64_t> dropped{0};
+    uint64_t recording = 0; // the `start` it holds spans of, see `tracer::record`
+
+    thread_buffer(uint32_t tid, std::string thread_name)
+        : _head(make_chunk())
+        , _tail(_head)
+        , tid(tid)
+        , thread_name(std::move(thread_name)) {}
+
+    thread_buffer(const thread_buffer &) = delete;
+    thread_buffer &operator=(const thread_buffer &) = delete;
+
+    void push(const event &e, size_t max_chunks) {
+        size_t used = _tail->used.load(std::memory_order_relaxed);
+        if (used == chunk_size) {
+            if (_chunks >= max_chunks) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            chunk *fresh = make_chunk();
+            _tail->next.store(fresh, std::memory_order_release);
+            _tail = fresh;
+            _chunks++;
+            used = 0;
+        }
+        _tail->events[used] = e;
+        _tail->used.store(used + 1, std::memory_order_release);
+    }
+
+    // back to one empty chunk. the owning thread calls it under the tracer's
+    // lock, so no dump is walking the chunks meanwhile.
+    void clear() {
+        chunk *c = _head->next.exchange(nullptr, std::memory_order_relaxed);
+        while (c != nullptr) {
+            chunk *next = c->next.load(std::memory_order_relaxed);
+            c->~chunk();
+            std::free(c);
+            c = next;
+        }
+        _head->used.store(0, std::memory_order_relaxed);
+        _tail = _head;
+        _chunks = 1;
+        dropped.store(0, std::memory_order_relaxed);
+    }
+
+    template <typename F>
+    void for_each(F &&fun) const {
+        for (const chunk *c = _head; c != nullptr; c = c->next.load(std::memory_order_acquire)) {
+            size_t used = c->used.load(std::memory_order_acquire);
+            for (size_t i = 0; i < used; i++) {
+                fun(c->events[i]);
+            }
+        }
+    }
+};
+
+} // namespace detail
+
+class tracer {
+    std::mutex _mtx;
+    // buffers outlive their threads, a dump after a worker exits has its spans
+    std::vector<std::unique_ptr<detail::thread_buffer>> _threads;
+    std::atomic<bool> _enabled{false};
+    std::atomic<size_t> _max_chunks{1};
+    std::atomic<uint64_t> _since{0};
+    std::atomic<uint64_t> _recording{0}; // bumped by every `start`
+
+    static detail::thread_buffer *&local() {
+        static thread_local detail::thread_buffer *tls_buffer = nullptr;
+        return tls_buffer;
+    }
+
+    static const char *&local_name() {
+        static thread_local const char *tls_name = nullptr;
+        return tls_name;
+    }
+
+    detail::thread_buffer &buffer() {
+        auto *&own = local();
+        if (own == nullptr) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto tid = static_cast<uint32_t>(_threads.size() + 1);
+            _threads.push_back(std::make_unique<detail::thread_buffer>(tid, local_name() ? local_name() : ""));
+            own = _threads.back().get();
+        }
+        return *own;
+    }
+
+  public:
+    static tracer &instance() {
+        static tracer *instance = new tracer(); // outlives static destructors
+        return *instance;
+    }
+
+    // records spans from now on, up to about `max_events` per thread. a dump
+    // only has the spans since the last start, whose room they get to
+    // themselves: a thread drops what it recorded before when it next records.
+    void start(size_t max_events = size_t(1) << 20) {
+        _max_chunks = std::max<size_t>(max_events / detail::thread_buffer::chunk_size, 1);
+        _since = detail::now_ns();
+        _recording.fetch_add(1, std::memory_order_release);
+        _enabled.store(true, std::memory_order_release);
+    }
+
+    void stop() { _enabled.store(false, std::memory_order_release); }
+
+    bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+    void record(const char *name, const char *category, uint64_t start_ns, uint64_t duration_ns, uint64_t count) {
+        auto &own = buffer();
+        uint64_t recording = _recording.load(std::memory_order_acquire);
+        if (own.recording != recording) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            own.clear();
+            own.recording = recording;
+        }
+        own.push(event{name, category, start_ns, duration_ns, count}, _max_chunks.load(std::memory_order_relaxed));
+    }
+
+    // what the calling thread is called in the timeline
+    void name_thread(const char *name) {
+        local_name() = name;
+        if (auto *own = local()) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            own->thread_name = name;
+        }
+    }
+
+    // chrome trace-event json, timestamps in microseconds since `start`
+    std::string json() {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(3);
+        uint64_t since = _since.load();
+        uint64_t recording = _recording.load();
+        uint64_t dropped = 0;
+        auto pid = getpid();
+        os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+        const char *separator = "\n  ";
+        std::lock_guard<std::mutex> lock(_mtx);
+        for (const auto &thread : _threads) {
+            if (!thread->thread_name.empty()) {
+                os << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+                   << ", \"tid\": " << thread->tid << ", \"args\": {\"name\": \"";
+                rx::detail::escape_quoted(os, thread->thread_name);
+                os << "\"}}";
+                separator = ",\n  ";
+            }
+            // a thread that recorded nothing since the last start still
+            // holds what it had before
+            if (thread->recording != recording) {
+                continue;
+            }
+            dropped += thread->dropped.load();
+            thread->for_each([&](const event &e) {
+                if (e.start_ns < since) {
+                    return;
+                }
+                os << separator << "{\"name\": \"";
+                rx::detail::escape_quoted(os, e.name);
+                os << "\", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"ts\": " << (e.start_ns - since) / 1e3
+                   << ", \"dur\": " << e.duration_ns / 1e3 << ", \"pid\": " << pid << ", \"tid\": " << thread->tid;
+                if (e.count != 0) {
+                    os << ", \"args\": {\"count\": " << e.count << "}";
+                }
+                os << "}";
+                separator = ",\n  ";
+            });
+        }
+        os << "\n], \"otherData\": {\"dropped_spans\": " << dropped << "}}\n";
+        return os.str();
+    }
+
+    // through a temporary file renamed into place, as `registry::write`
+    bool write(const std::string &path) { return rx::detail::write_file(path, json()); }
+};
+
+// the scope it lives in, as a span. `name` and `category` must outlive the
+// tracer, a literal or a stage's name. nothing without RX_TRACE.
+#ifdef RX_TRACE
+class span {
+    const char *_name;
+    const char *_category;
+    const char *_outer;
+    uint64_t _count;
+    uint64_t _start = 0; // 0 while not recording
+
+  public:
+    span(const char *name, const char *category, uint64_t count = 0)
+        : _name(name)
+        , _category(category)
+        , _outer(detail::current())
+        , _count(count) {
+        detail::current() = name;
+        if (tracer::instance().enabled()) {
+            _start = detail::now_ns();
+        }
+    }
+
+    ~span() {
+        detail::current() = _outer;
+        if (_start != 0) {
+            tracer::instance().record(_name, _category, _start, detail::now_ns() - _start, _count);
+        }
+    }
+
+    span(const span &) = delete;
+    span &operator=(const span &) = delete;
+};
+#else
+class span {
+  public:
+    span(const char *, const char *, uint64_t = 0) {}
+};
+#endif
+
+// `action` wrapped to run as a span named after the stage that scheduled it,
+// `fallback` when there is none, for schedulers to wrap what they queue.
+// wrapped even while not recording, so timers armed before a `start` show.
+template <typename Action>
+Action traced(Action action, const char *category, const char *fallback) {
+#ifdef RX_TRACE
+    const char *name = detail::current() != nullptr ? detail::current() : fallback;
+    return [name, category, inner = std::move(action)](auto &&...args) {
+        span running(name, category);
+        return inner(std::forward<decltype(args)>(args)...);
+    };
+#else
+    (void)category;
+    (void)fallback;
+    return action;
+#endif
+}
+
+inline void name_thread(const char *name) {
+#ifdef RX_TRACE
+    tracer::instance().name_thread(name);
+#else
+    (void)name;
+#endif
+}
+
+} // namespace trace
+
+} // namespace rx
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "refc_ptr.hpp"
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace rx {
+
+// vectors that go back to the pool, cleared but with their capacity, when
+// the last reference is dropped, so an operator that emits batches stops
+// allocating once it is warmed up. like `buffer_pool`, vectors that are
+// handed out keep the pool alive, free ones are owned by it.
+template <typename T>
+class vector_pool : public enable_refc_from_this<vector_pool<T>> {
+  public:
+    class block : public refc_block<refc_atomic> {
+        friend class vector_pool;
+
+        refc_ptr<vector_pool, refc_atomic> _owner; // set while handed out
+
+        block() {
+            this->dispose = [](refc_block<refc_atomic> *self) {
+                auto *released = static_cast<block *>(self);
+                auto owner = std::move(released->_owner);
+                owner->give_back(released);
+            };
+        }
+
+      public:
+        std::vector<T> values;
+    };
+
+    using handle = refc_ptr<block>;
+
+  private:
+    size_t _max_free;
+    std::mutex _mtx;
+    std::vector<block *> _free;
+
+    void give_back(block *released) {
+        released->values.clear();
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_free.size() < _max_free) {
+                _free.push_back(released);
+                return;
+            }
+        }
+        delete released;
+    }
+
+    block *take_free() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_free.empty()) {
+            return nullptr;
+        }
+        auto *found = _free.back();
+        _free.pop_back();
+        return found;
+    }
+
+  public:
+    // keeps up to `max_free` idle vectors around for reuse
+    explicit vector_pool(size_t max_free = 64)
+        : _max_free(max_free) {}
+
+    vector_pool(const vector_pool &) = delete;
+    vector_pool &operator=(const vector_pool &) = delete;
+
+    ~vector_pool() {
+        for (auto *idle : _free) {
+            delete idle;
+        }
+    }
+
+    // an empty vector with room for at least `capacity` elements. the pool
+    // must be owned by a refc_ptr.
+    handle acquire(size_t capacity = 0) {
+        block *found = take_free();
+        if (found == nullptr) {
+            found = new block();
+        }
+        found->values.reserve(capacity);
+        found->_owner = this->refc_from_this();
+        return handle(found);
+    }
+
+    // takes back a vector that was moved out of a `pooled_vector`
+    void recycle(std::vector<T> &&values) {
+        block *found = take_free();
+        if (found == nullptr) {
+            found = new block();
+        }
+        found->values = std::move(values);
+        found->_owner = this->refc_from_this();
+        // dropping the only reference files it as free
+        handle filed(found);
+    }
+};
+
+// a batch from a `vector_pool`. copies share the vector, so passing one on
+// costs a reference count. the last one returns the vector to its pool,
+// unless a consumer `take()`s it for itself.
+template <typename T>
+class pooled_vector {
+    typename vector_pool<T>::handle _block;
+
+  public:
+    using value_type = T;
+
+    pooled_vector() = default;
+
+    explicit pooled_vector(typename vector_pool<T>::handle block)
+        : _block(std::move(block)) {}
+
+    const std::vector<T> &values() const { return _block->values; }
+    operator const std::vector<T> &() const { return _block->values; }
+
+    const T *data() const { return values().data(); }
+    size_t size() const { return values().size(); }
+    bool empty() const { return values().empty(); }
+    auto begin() const { return values().begin(); }
+    auto end() const { return values().end(); }
+    const T &operator[](size_t i) const { return values()[i]; }
+
+    // the vector, for a consumer that keeps the batch: moved out of the last
+    // copy of the batch, copied while any other copy can still see it.
+    // observers get batches by const reference, so they take from a copy of
+    // their own, `pooled_vector<T>(batch).take()`, which copies.
+    std::vector<T> take() && {
+        if (!_block) {
+            return {};
+        }
+        if (_block->count.load(std::memory_order_acquire) == 1) {
+            return std::move(_block->values);
+        }
+        return _block->values;
+    }
+};
+
+} // namespace rx